@@ -0,0 +1,178 @@
+/**
+*  \file benchmark.cpp
+*  \brief timing of structured edge detection stages and forest evaluation engines
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "structuredEdgeDetection.h"
+
+static double milliseconds(const int64 start)
+{
+    return 1000.0*(cv::getTickCount() - start) / cv::getTickFrequency();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::fprintf(stderr, "usage: %s <model> <image> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    const int iterations = argc > 3 ? std::max(1, std::atoi(argv[3])) : 10;
+
+    try
+    {
+        int64 start = cv::getTickCount();
+        StructuredEdgeDetection detector(argv[1]);
+        std::printf("model loading: %.2f ms\n", milliseconds(start));
+
+        cv::Mat src = cv::imread(argv[2]);
+        if (src.empty())
+        {
+            std::fprintf(stderr, "can't read %s\n", argv[2]);
+            return 1;
+        }
+
+        cv::cvtColor(src, src, CV_BGR2RGB);
+        src.convertTo(src, cv::DataType<float>::type, 1/255.0);
+
+        DetectionWorkspace workspace;
+
+        NChannelsMat features;
+        start = cv::getTickCount();
+        for (int i = 0; i < iterations; ++i)
+            detector.__getFeatures(src, features, workspace);
+        std::printf("features: %.2f ms\n", milliseconds(start) / iterations);
+
+        const char *names[] = {"scalar", "simd", "quickscorer"};
+        const int types[] = {FOREST_EVALUATION_SCALAR, FOREST_EVALUATION_SIMD,
+                             FOREST_EVALUATION_QUICKSCORER};
+
+        NChannelsMat reference;
+        for (int t = 0; t < 3; ++t)
+        {
+            NChannelsMat indexes;
+
+            detector.setForestEvaluation(types[t]);
+            detector.__evaluateForest(features, indexes, workspace);
+            // warm up, compiles forest for this width
+
+            start = cv::getTickCount();
+            for (int i = 0; i < iterations; ++i)
+                detector.__evaluateForest(features, indexes, workspace);
+            double time = milliseconds(start) / iterations;
+
+            if (reference.empty())
+                reference = indexes;
+
+            bool identical = cv::norm(reference, indexes, cv::NORM_INF) == 0;
+            std::printf("forest evaluation, %-12s %8.2f ms%s\n", names[t], time,
+                identical ? "" : "  (leaves differ from scalar!)");
+        }
+
+        cv::Mat edges, tiledEdges;
+
+        start = cv::getTickCount();
+        for (int i = 0; i < iterations; ++i)
+            detector.detectSingleScale(src, edges);
+        double singleScale = milliseconds(start) / iterations;
+        std::printf("detection, whole image: %8.2f ms\n", singleScale);
+
+        const int tileSizes[] = {256, 100};
+        for (int t = 0; t < 2; ++t)
+        {
+            start = cv::getTickCount();
+            for (int i = 0; i < iterations; ++i)
+                detector.detectSingleScaleTiled(src, tiledEdges, tileSizes[t]);
+            std::printf("detection, %3d tiles:   %8.2f ms, max difference %g\n", tileSizes[t],
+                milliseconds(start) / iterations, cv::norm(edges, tiledEdges, cv::NORM_INF));
+        }
+        // tiles of 100 start off the grid of tree phases of the whole image
+
+        std::vector <cv::Mat> batch(4, src), batchEdges;
+
+        start = cv::getTickCount();
+        for (int i = 0; i < iterations; ++i)
+            detector.detectBatch(batch, batchEdges);
+        std::printf("detection, batch of 4:  %8.2f ms per image, max difference %g\n",
+            milliseconds(start) / iterations / batch.size(),
+            cv::norm(edges, batchEdges.back(), cv::NORM_INF));
+
+        cv::Mat multiScaleEdges;
+
+        start = cv::getTickCount();
+        for (int i = 0; i < iterations; ++i)
+            detector.detectMultipleScales(src, multiScaleEdges);
+        double multiScale = milliseconds(start) / iterations;
+        std::printf("detection, 3 scales:    %8.2f ms, %.2fx single scale\n",
+            multiScale, multiScale / singleScale);
+
+        const float fiveScales[] = {0.5f, 0.75f, 1.0f, 1.5f, 2.0f};
+
+        DetectionParameters parameters;
+        parameters.scales.assign(fiveScales, fiveScales + 5);
+
+        cv::Mat exactEdges, fastEdges;
+        for (int fast = 0; fast < 2; ++fast)
+        {
+            parameters.fastPyramid = fast != 0;
+            detector.setDetectionParameters(parameters);
+
+            start = cv::getTickCount();
+            for (int i = 0; i < iterations; ++i)
+                detector.detectMultipleScales(src, fast ? fastEdges : exactEdges);
+            double time = milliseconds(start) / iterations;
+
+            std::printf("detection, 5 scales, %s %8.2f ms, %.2fx single scale\n",
+                fast ? "fast: " : "exact:", time, time / singleScale);
+        }
+        std::printf("fast pyramid max difference %g\n", cv::norm(exactEdges, fastEdges, cv::NORM_INF));
+
+        parameters = DetectionParameters();
+        parameters.stride = 2*detector.__rf.options.stride;
+        detector.setDetectionParameters(parameters);
+
+        cv::Mat strideEdges;
+
+        start = cv::getTickCount();
+        for (int i = 0; i < iterations; ++i)
+            detector.detectSingleScale(src, strideEdges);
+        std::printf("detection, stride %d:    %8.2f ms, max difference %g\n", parameters.stride,
+            milliseconds(start) / iterations, cv::norm(edges, strideEdges, cv::NORM_INF));
+
+        parameters = DetectionParameters();
+        parameters.coarseToFine = true;
+        detector.setDetectionParameters(parameters);
+
+        cv::Mat sparseEdges;
+
+        start = cv::getTickCount();
+        for (int i = 0; i < iterations; ++i)
+            detector.detectSingleScale(src, sparseEdges);
+        double sparse = milliseconds(start) / iterations;
+
+        const cv::Mat &weights = detector.__workspaces[0].patchWeights;
+        std::printf("detection, coarse-to-fine: %6.2f ms, %.2fx faster, %.1f%% of patches refined\n",
+            sparse, singleScale / sparse, 100.0 * cv::countNonZero(weights == 1) / weights.total());
+        std::printf("coarse-to-fine max difference %g, mean difference %g\n",
+            cv::norm(edges, sparseEdges, cv::NORM_INF),
+            cv::norm(edges, sparseEdges, cv::NORM_L1) / edges.total());
+
+        detector.detectSingleScaleTiled(src, tiledEdges, 100);
+        std::printf("coarse-to-fine, 100 tiles max difference %g\n",
+            cv::norm(sparseEdges, tiledEdges, cv::NORM_INF));
+    }
+    catch (const cv::Exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
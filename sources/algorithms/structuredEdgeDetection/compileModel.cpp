@@ -0,0 +1,54 @@
+/**
+*  \file compileModel.cpp
+*  \brief offline compiler of YAML models into the binary model format (see randomForest.h)
+*/
+
+#include <cstdio>
+#include <string>
+
+#include "randomForest.h"
+
+static size_t printSection(const char *name, size_t length, size_t elementSize)
+{
+    size_t bytes = length*elementSize;
+    std::printf("  %-16s %10d elements %12.1f KiB\n", name, int(length), bytes/1024.0);
+
+    return bytes;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        std::fprintf(stderr, "usage: %s <model.yml> <model.bin>\n", argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        RandomForest rf;
+        loadYamlForest(argv[1], rf);
+        validateEdges(rf);
+
+        saveBinaryForest(argv[2], rf);
+
+        std::printf("%s: %d trees x %d nodes\n", argv[2],
+            rf.options.numberOfTrees, rf.numberOfTreeNodes);
+
+        size_t total = sizeof(BinaryForestHeader);
+        total += printSection("childs", rf.childs.size(), sizeof(int));
+        total += printSection("featureIds", rf.featureIds.size(), sizeof(int));
+        total += printSection("thresholds", rf.thresholds.size(), sizeof(float));
+        total += printSection("edgeBoundaries", rf.edgeBoundaries.size(), sizeof(int));
+        total += printSection("edgeBins", rf.edgeBins.size(), sizeof(int));
+
+        std::printf("  %-16s %33.1f KiB (without alignment)\n", "total", total/1024.0);
+    }
+    catch (const cv::Exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
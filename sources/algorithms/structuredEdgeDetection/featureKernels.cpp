@@ -0,0 +1,642 @@
+#include "featureKernels.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#ifdef FEATURE_KERNELS_SSE2
+#  include <emmintrin.h>
+#endif
+
+static cv::Range outputRows(const cv::Range &rows, cv::Mat &dst, const cv::Size &size, const int type)
+{
+    if (rows == cv::Range::all())
+    {
+        dst.create(size, type);
+        return cv::Range(0, size.height);
+    }
+
+    CV_Assert( dst.size() == size && dst.type() == type
+        && rows.start >= 0 && rows.start <= rows.end && rows.end <= size.height );
+    return rows;
+}
+// rows of dst a kernel computes, dst is allocated for all of them
+
+//----------------------------------------------------------
+// RGB --> Lab
+
+#define GAMMA_LUT_SIZE 1024
+
+struct GammaTable
+{
+    float values[GAMMA_LUT_SIZE + 2];
+
+    GammaTable()
+    {
+        for (int i = 0; i <= GAMMA_LUT_SIZE + 1; ++i)
+        {
+            double x = std::min(1.0, double(i) / GAMMA_LUT_SIZE);
+            values[i] = float(x <= 0.04045 ? x / 12.92 : std::pow((x + 0.055) / 1.055, 2.4));
+        }
+    }
+};
+// sRGB gamma expansion sampled on [0, 1]
+
+static const GammaTable gammaTable; // built before any detector exists
+
+static inline float linearize(const float *table, const float value)
+{
+    float x = std::min(std::max(value, 0.0f), 1.0f) * GAMMA_LUT_SIZE;
+    int i = int(x);
+
+    return table[i] + (x - i)*(table[i + 1] - table[i]);
+}
+// gamma expansion with linear interpolation in the table
+
+static const float xyzMatrix[9] =
+{
+    0.412453f / 0.950456f, 0.357580f / 0.950456f, 0.180423f / 0.950456f,
+    0.212671f,             0.715160f,             0.072169f,
+    0.019334f / 1.088754f, 0.119193f / 1.088754f, 0.950227f / 1.088754f
+};
+// sRGB --> XYZ, rows normalized by D65 white point (as cv::cvtColor does)
+
+#define LAB_THRESHOLD 0.008856f
+
+static inline float cubeRoot(const float t)
+{
+    union { float f; int i; } bits;
+    bits.f = t;
+    bits.i = int(float(bits.i) * (1.0f/3)) + 709921077;
+    // exponent divided by 3 as an initial guess
+
+    float y = bits.f;
+    for (int k = 0; k < 3; ++k)
+        y = (2.0f*y + t / (y*y)) * (1.0f/3);
+    // Newton iterations
+
+    return y;
+}
+// for t >= 0, same operations as SSE2 version
+
+static inline float labFunction(const float t)
+{
+    return t > LAB_THRESHOLD ? cubeRoot(t) : 7.787f*t + 16.0f/116;
+}
+
+static inline void rgbToLabPixel(const float *table, const float *src, float *dst)
+{
+    float r = linearize(table, src[0]);
+    float g = linearize(table, src[1]);
+    float b = linearize(table, src[2]);
+
+    float x = xyzMatrix[0]*r + xyzMatrix[1]*g + xyzMatrix[2]*b;
+    float y = xyzMatrix[3]*r + xyzMatrix[4]*g + xyzMatrix[5]*b;
+    float z = xyzMatrix[6]*r + xyzMatrix[7]*g + xyzMatrix[8]*b;
+
+    float fx = labFunction(x), fy = labFunction(y), fz = labFunction(z);
+
+    dst[0] = (116.0f*fy - 16.0f) * (1.0f/100);
+    dst[1] = (500.0f*(fx - fy) + 128.0f) * (1.0f/255);
+    dst[2] = (200.0f*(fy - fz) + 128.0f) * (1.0f/255);
+}
+// 116*f(y) - 16 is 903.3*y below the threshold
+
+#ifdef FEATURE_KERNELS_SSE2
+
+static inline __m128 cubeRootSSE2(const __m128 t)
+{
+    __m128i bits = _mm_castps_si128(t);
+    bits = _mm_add_epi32(_mm_cvttps_epi32(_mm_mul_ps(
+        _mm_cvtepi32_ps(bits), _mm_set1_ps(1.0f/3))), _mm_set1_epi32(709921077));
+
+    __m128 y = _mm_castsi128_ps(bits);
+    for (int k = 0; k < 3; ++k)
+        y = _mm_mul_ps(_mm_add_ps(_mm_add_ps(y, y), _mm_div_ps(t, _mm_mul_ps(y, y))),
+            _mm_set1_ps(1.0f/3));
+
+    return y;
+}
+
+static inline __m128 labFunctionSSE2(const __m128 t)
+{
+    __m128 mask = _mm_cmpgt_ps(t, _mm_set1_ps(LAB_THRESHOLD));
+    __m128 linear = _mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(7.787f)), _mm_set1_ps(16.0f/116));
+
+    return _mm_or_ps(_mm_and_ps(mask, cubeRootSSE2(t)), _mm_andnot_ps(mask, linear));
+}
+
+#endif
+
+void rgbToLab(const float *src, float *dst, const int count)
+{
+    const float *table = gammaTable.values;
+    int n = 0;
+
+#ifdef FEATURE_KERNELS_SSE2
+    CV_DECL_ALIGNED(16) float r[4], g[4], b[4], L[4], A[4], B[4];
+
+    for (; n + 4 <= count; n += 4, src += 12, dst += 12)
+    {
+        for (int k = 0; k < 4; ++k)
+        {
+            r[k] = linearize(table, src[3*k + 0]);
+            g[k] = linearize(table, src[3*k + 1]);
+            b[k] = linearize(table, src[3*k + 2]);
+        }
+        // lookups are scalar, SSE2 has no gathers
+
+        __m128 vr = _mm_load_ps(r), vg = _mm_load_ps(g), vb = _mm_load_ps(b);
+
+        __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vr, _mm_set1_ps(xyzMatrix[0])),
+            _mm_mul_ps(vg, _mm_set1_ps(xyzMatrix[1]))), _mm_mul_ps(vb, _mm_set1_ps(xyzMatrix[2])));
+        __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vr, _mm_set1_ps(xyzMatrix[3])),
+            _mm_mul_ps(vg, _mm_set1_ps(xyzMatrix[4]))), _mm_mul_ps(vb, _mm_set1_ps(xyzMatrix[5])));
+        __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vr, _mm_set1_ps(xyzMatrix[6])),
+            _mm_mul_ps(vg, _mm_set1_ps(xyzMatrix[7]))), _mm_mul_ps(vb, _mm_set1_ps(xyzMatrix[8])));
+
+        __m128 fx = labFunctionSSE2(x), fy = labFunctionSSE2(y), fz = labFunctionSSE2(z);
+
+        _mm_store_ps(L, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(fy, _mm_set1_ps(116.0f)),
+            _mm_set1_ps(16.0f)), _mm_set1_ps(1.0f/100)));
+        _mm_store_ps(A, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(fx, fy),
+            _mm_set1_ps(500.0f)), _mm_set1_ps(128.0f)), _mm_set1_ps(1.0f/255)));
+        _mm_store_ps(B, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(fy, fz),
+            _mm_set1_ps(200.0f)), _mm_set1_ps(128.0f)), _mm_set1_ps(1.0f/255)));
+
+        for (int k = 0; k < 4; ++k)
+        {
+            dst[3*k + 0] = L[k];
+            dst[3*k + 1] = A[k];
+            dst[3*k + 2] = B[k];
+        }
+    }
+#endif
+
+    for (; n < count; ++n, src += 3, dst += 3)
+        rgbToLabPixel(table, src, dst);
+}
+
+//----------------------------------------------------------
+// gradients
+
+static inline float phaseOf(const float dx, const float dy)
+{
+    float ax = std::abs(dx), ay = std::abs(dy);
+
+    float a = std::min(ax, ay) / (std::max(ax, ay) + FLT_EPSILON);
+    float s = a*a;
+    float r = ((-0.0464964749f*s + 0.15931422f)*s - 0.327622764f)*s*a + a;
+    // atan(a) for a in [0, 1], error below 1e-5
+
+    if (ay > ax) r = float(CV_PI/2) - r;
+    if (dx < 0)  r = float(CV_PI) - r;
+    if (dy < 0)  r = float(2*CV_PI) - r;
+
+    return r;
+}
+// atan2(dy, dx) in [0, 2*pi], same operations as SSE2 version
+
+#ifdef FEATURE_KERNELS_SSE2
+
+static inline __m128 absSSE2(const __m128 x)
+{
+    return _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)));
+}
+
+static inline __m128 selectSSE2(const __m128 mask, const __m128 a, const __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128 phaseOfSSE2(const __m128 dx, const __m128 dy)
+{
+    __m128 ax = absSSE2(dx), ay = absSSE2(dy);
+
+    __m128 a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_add_ps(_mm_max_ps(ax, ay), _mm_set1_ps(FLT_EPSILON)));
+    __m128 s = _mm_mul_ps(a, a);
+    __m128 r = _mm_mul_ps(_mm_set1_ps(-0.0464964749f), s);
+    r = _mm_mul_ps(_mm_add_ps(r, _mm_set1_ps(0.15931422f)), s);
+    r = _mm_mul_ps(_mm_sub_ps(r, _mm_set1_ps(0.327622764f)), s);
+    r = _mm_add_ps(_mm_mul_ps(r, a), a);
+
+    const __m128 zero = _mm_setzero_ps();
+    r = selectSSE2(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(float(CV_PI/2)), r), r);
+    r = selectSSE2(_mm_cmplt_ps(dx, zero), _mm_sub_ps(_mm_set1_ps(float(CV_PI)), r), r);
+    r = selectSSE2(_mm_cmplt_ps(dy, zero), _mm_sub_ps(_mm_set1_ps(float(2*CV_PI)), r), r);
+
+    return r;
+}
+
+#endif
+
+static void loadPlanarRow(const cv::Mat &src, const int row, float *planes, const int planeStep)
+{
+    const int cn = src.channels(), width = src.cols;
+    const float *srcPtr = src.ptr<float>(row);
+
+    for (int c = 0; c < cn; ++c)
+    {
+        float *plane = planes + c*planeStep;
+
+        for (int x = 0; x < width; ++x)
+            plane[x + 1] = srcPtr[x*cn + c];
+
+        plane[0] = plane[1];
+        plane[width + 1] = plane[width];
+    }
+}
+// channels of row as separate planes with one reflected pixel on each side
+
+void gradientMagnitudeOrientation(const cv::Mat &src, cv::Mat &magnitude, cv::Mat &bins,
+    const int numberOfBins, std::vector <float> &buffer, const cv::Range &rows)
+{
+    CV_Assert( src.depth() == CV_32F && numberOfBins > 0 && numberOfBins <= 256 );
+
+    const int cn = src.channels();
+    const int width = src.cols, height = src.rows;
+    const int planeStep = width + 2;
+
+    const cv::Range range = outputRows(rows, magnitude, src.size(), CV_32FC1);
+    outputRows(rows, bins, src.size(), CV_8UC1);
+
+    if (range.start == range.end)
+        return;
+
+    buffer.resize(3*cn*planeStep);
+
+    float *up   = &buffer[0];
+    float *mid  = &buffer[cn*planeStep];
+    float *down = &buffer[2*cn*planeStep];
+    // planar rows y - 1, y, y + 1, rotated as y goes down
+
+    loadPlanarRow(src, cv::borderInterpolate(range.start - 1, height, cv::BORDER_REFLECT), up, planeStep);
+    loadPlanarRow(src, range.start, mid, planeStep);
+
+    const float binScale = float(numberOfBins / (2*CV_PI));
+
+    for (int y = range.start; y < range.end; ++y)
+    {
+        loadPlanarRow(src, cv::borderInterpolate(y + 1, height, cv::BORDER_REFLECT), down, planeStep);
+
+        float *magnitudePtr = magnitude.ptr<float>(y);
+        uchar *binPtr = bins.ptr<uchar>(y);
+
+        int x = 0;
+
+#ifdef FEATURE_KERNELS_SSE2
+        CV_DECL_ALIGNED(16) int binValues[4];
+
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128 bestDx = _mm_setzero_ps(), bestDy = _mm_setzero_ps();
+            __m128 best = _mm_set1_ps(-1.0f);
+
+            for (int c = 0; c < cn; ++c)
+            {
+                const float *u = up   + c*planeStep + x;
+                const float *m = mid  + c*planeStep + x;
+                const float *d = down + c*planeStep + x;
+
+                __m128 dx = _mm_add_ps(_mm_add_ps(
+                    _mm_sub_ps(_mm_loadu_ps(u + 2), _mm_loadu_ps(u)),
+                    _mm_mul_ps(_mm_set1_ps(2.0f), _mm_sub_ps(_mm_loadu_ps(m + 2), _mm_loadu_ps(m)))),
+                    _mm_sub_ps(_mm_loadu_ps(d + 2), _mm_loadu_ps(d)));
+                __m128 dy = _mm_add_ps(_mm_add_ps(
+                    _mm_sub_ps(_mm_loadu_ps(d), _mm_loadu_ps(u)),
+                    _mm_mul_ps(_mm_set1_ps(2.0f), _mm_sub_ps(_mm_loadu_ps(d + 1), _mm_loadu_ps(u + 1)))),
+                    _mm_sub_ps(_mm_loadu_ps(d + 2), _mm_loadu_ps(u + 2)));
+
+                __m128 m2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+                __m128 better = _mm_cmpgt_ps(m2, best);
+
+                best = selectSSE2(better, m2, best);
+                bestDx = selectSSE2(better, dx, bestDx);
+                bestDy = selectSSE2(better, dy, bestDy);
+            }
+
+            _mm_storeu_ps(magnitudePtr + x, _mm_sqrt_ps(best));
+
+            __m128 phase = phaseOfSSE2(bestDx, bestDy);
+            _mm_store_si128((__m128i *) binValues, _mm_cvttps_epi32(_mm_mul_ps(phase, _mm_set1_ps(binScale))));
+
+            for (int k = 0; k < 4; ++k)
+                binPtr[x + k] = uchar(std::min(binValues[k], numberOfBins - 1));
+        }
+#endif
+
+        for (; x < width; ++x)
+        {
+            float bestDx = 0, bestDy = 0, best = -1.0f;
+
+            for (int c = 0; c < cn; ++c)
+            {
+                const float *u = up   + c*planeStep + x;
+                const float *m = mid  + c*planeStep + x;
+                const float *d = down + c*planeStep + x;
+
+                float dx = ((u[2] - u[0]) + 2.0f*(m[2] - m[0])) + (d[2] - d[0]);
+                float dy = ((d[0] - u[0]) + 2.0f*(d[1] - u[1])) + (d[2] - u[2]);
+
+                float m2 = dx*dx + dy*dy;
+                if (m2 > best)
+                {
+                    best = m2;
+                    bestDx = dx;
+                    bestDy = dy;
+                }
+            }
+            // channel with the largest gradient
+
+            magnitudePtr[x] = std::sqrt(best);
+            binPtr[x] = uchar(std::min(int(phaseOf(bestDx, bestDy)*binScale), numberOfBins - 1));
+        }
+
+        float *rotated = up;
+        up = mid;
+        mid = down;
+        down = rotated;
+    }
+}
+
+//----------------------------------------------------------
+// histograms
+
+void orientationHistograms(const cv::Mat &magnitude, const cv::Mat &bins, const int numberOfBins,
+    const int cellSize, const cv::Size &size, std::vector <cv::Mat> &histograms,
+    std::vector <float> &buffer, const cv::Range &rows)
+{
+    CV_Assert( magnitude.type() == CV_32FC1 && bins.type() == CV_8UC1
+        && magnitude.size() == bins.size() && cellSize > 0 );
+
+    if (rows == cv::Range::all())
+        histograms.resize(numberOfBins);
+    CV_Assert( int(histograms.size()) == numberOfBins );
+
+    cv::Range range;
+    for (int b = 0; b < numberOfBins; ++b)
+    {
+        range = outputRows(rows, histograms[b], size, CV_32FC1);
+        histograms[b].rowRange(range).setTo(0);
+    }
+
+    const int first = range.start*cellSize;
+    const int last = std::min(magnitude.rows, range.end*cellSize);
+    const int cols = std::min(magnitude.cols, size.width*cellSize);
+    const int cells = (cols + cellSize - 1) / cellSize;
+
+    buffer.assign(cells*cellSize + 1, 0.0f);
+    float *masked = &buffer[0];
+    // magnitude of one row where bin matches, 0 elsewhere
+
+    for (int i = first; i < last; ++i)
+    {
+        const float *magnitudePtr = magnitude.ptr<float>(i);
+        const uchar *binPtr = bins.ptr<uchar>(i);
+
+        for (int b = 0; b < numberOfBins; ++b)
+        {
+            int j = 0;
+
+#ifdef FEATURE_KERNELS_SSE2
+            const __m128i bin = _mm_set1_epi32(b);
+            const __m128i zero = _mm_setzero_si128();
+
+            for (; j + 4 <= cols; j += 4)
+            {
+                int packed;
+                std::memcpy(&packed, binPtr + j, sizeof(packed));
+
+                __m128i bins4 = _mm_unpacklo_epi16(_mm_unpacklo_epi8(
+                    _mm_cvtsi32_si128(packed), zero), zero);
+                __m128 mask = _mm_castsi128_ps(_mm_cmpeq_epi32(bins4, bin));
+
+                _mm_storeu_ps(&masked[j], _mm_and_ps(mask, _mm_loadu_ps(magnitudePtr + j)));
+            }
+#endif
+
+            for (; j < cols; ++j)
+                masked[j] = binPtr[j] == b ? magnitudePtr[j] : 0.0f;
+            // compare and mask, no stores depending on data
+
+            float *histPtr = histograms[b].ptr<float>(i / cellSize);
+
+            if (cellSize == 1)
+                for (int c = 0; c < cells; ++c)
+                    histPtr[c] += masked[c];
+            else
+                for (int c = 0; c < cells; ++c)
+                {
+                    float sum = 0.0f;
+                    for (int k = 0; k < cellSize; ++k)
+                        sum += masked[c*cellSize + k];
+
+                    histPtr[c] += sum;
+                }
+        }
+    }
+}
+
+//----------------------------------------------------------
+// smoothing
+
+static void reflectRow(const float *row, float *padded, const int cols, const int cn, const int radius)
+{
+    std::copy(row, row + cols*cn, padded + radius*cn);
+
+    for (int k = 1; k <= radius; ++k)
+    {
+        const float *left  = row + cv::borderInterpolate(-k, cols, cv::BORDER_REFLECT)*cn;
+        const float *right = row + cv::borderInterpolate(cols - 1 + k, cols, cv::BORDER_REFLECT)*cn;
+
+        std::copy(left,  left + cn,  padded + (radius - k)*cn);
+        std::copy(right, right + cn, padded + (radius + cols - 1 + k)*cn);
+    }
+}
+// row with radius reflected pixels on both sides
+
+static void boxRow(const float *padded, float *dst, const int cols, const int cn, const int radius)
+{
+    for (int c = 0; c < cn; ++c)
+    {
+        float sum = 0.0f;
+        for (int k = 0; k <= 2*radius; ++k)
+            sum += padded[k*cn + c];
+
+        dst[c] = sum;
+        for (int x = 1; x < cols; ++x)
+        {
+            sum += padded[(x + 2*radius)*cn + c] - padded[(x - 1)*cn + c];
+            dst[x*cn + c] = sum;
+        }
+    }
+}
+// unnormalized horizontal box of the reflected row
+
+class TriangleSmoother
+{
+public:
+    TriangleSmoother(const cv::Mat &_src, cv::Mat &_dst, const int _radius, float *scratch,
+        const int _start)
+        : src(_src), dst(_dst), radius(_radius), start(_start),
+          firstStart(std::max(_start - _radius, 0)), computed(firstStart)
+    {
+        CV_Assert( src.depth() == CV_32F && radius > 0 );
+        CV_Assert( dst.size() == src.size() && dst.type() == src.type() && dst.data != src.data );
+
+        cn = src.channels();
+        width = src.cols*cn;
+
+        ringSize = 2*radius + 2;
+        ring = scratch;
+        firstSum  = ring + ringSize*width;
+        secondSum = firstSum + width;
+        boxed  = secondSum + width;
+        padded = boxed + width;
+
+        const double area = double(2*radius + 1)*(2*radius + 1);
+        scale = float(1.0 / (area*area));
+    }
+
+    static size_t scratchSize(const cv::Mat &src, const int radius)
+    {
+        return size_t(2*radius + 5)*src.cols*src.channels()
+            + size_t(src.cols + 2*radius)*src.channels();
+    }
+    // ring, sums and row buffers below
+
+    void row(const int y)
+    {
+        const int rows = src.rows;
+
+        for (; computed <= std::min(y + radius, rows - 1); ++computed)
+        {
+            float *firstPtr = firstSum;
+
+            if (computed == firstStart)
+            {
+                std::fill(firstSum, firstSum + width, 0.0f);
+                for (int k = -radius; k <= radius; ++k)
+                    add(firstPtr, source(computed + k), 1.0f);
+            }
+            else
+            {
+                add(firstPtr, source(computed + radius), 1.0f);
+                add(firstPtr, source(computed - 1 - radius), -1.0f);
+            }
+
+            std::copy(firstSum, firstSum + width, first(computed));
+        }
+        // first vertical box up to the row y + radius, from the first row
+        // the second box of the row start needs
+
+        float *secondPtr = secondSum;
+
+        if (y == start)
+        {
+            std::fill(secondSum, secondSum + width, 0.0f);
+            for (int k = -radius; k <= radius; ++k)
+                add(secondPtr, first(cv::borderInterpolate(y + k, rows, cv::BORDER_REFLECT)), 1.0f);
+        }
+        else
+        {
+            add(secondPtr, first(cv::borderInterpolate(y + radius, rows, cv::BORDER_REFLECT)), 1.0f);
+            add(secondPtr, first(cv::borderInterpolate(y - 1 - radius, rows, cv::BORDER_REFLECT)), -1.0f);
+        }
+        // second vertical box, reflecting rows of the first one
+
+        reflectRow(secondPtr, padded, src.cols, cn, radius);
+        boxRow(padded, boxed, src.cols, cn, radius);
+
+        reflectRow(boxed, padded, src.cols, cn, radius);
+        boxRow(padded, dst.ptr<float>(y), src.cols, cn, radius);
+        // both horizontal boxes
+
+        float *dstPtr = dst.ptr<float>(y);
+        for (int x = 0; x < width; ++x)
+            dstPtr[x] *= scale;
+    }
+    // dst row y, rows have to go in order from start
+
+private:
+    const float *source(const int y) const
+    {
+        return src.ptr<float>(cv::borderInterpolate(y, src.rows, cv::BORDER_REFLECT));
+    }
+
+    float *first(const int y)
+    {
+        return ring + (y % ringSize)*width;
+    }
+    // first box of row y, if still in the ring
+
+    void add(float *sum, const float *row, const float sign) const
+    {
+        for (int x = 0; x < width; ++x)
+            sum[x] += sign*row[x];
+    }
+
+    const cv::Mat &src;
+    cv::Mat &dst;
+
+    int radius, cn, width;
+    int start, firstStart;
+    int ringSize, computed;
+    float scale;
+
+    float *ring;      // last ringSize rows of the first vertical box
+    float *firstSum;  // running sums of vertical boxes
+    float *secondSum;
+    float *boxed;     // row after the first horizontal box
+    float *padded;    // row with reflected margins
+};
+// triangle filter as two box filters in each direction, with reflection
+// after every box, just as two calls of cv::boxFilter(..., BORDER_REFLECT) do
+
+static cv::Range smoothedRows(const cv::Mat &src, cv::Mat &dst, const cv::Range &rows)
+{
+    if (rows == cv::Range::all() && dst.data == src.data)
+        dst.release();
+
+    return outputRows(rows, dst, src.size(), src.type());
+}
+// dst allocated for smoothing of src
+
+void smoothTriangle(const cv::Mat &src, cv::Mat &dst, const int radius,
+    std::vector <float> &buffer, const cv::Range &rows)
+{
+    const cv::Range range = smoothedRows(src, dst, rows);
+    if (range.start == range.end)
+        return;
+
+    buffer.resize(TriangleSmoother::scratchSize(src, radius));
+    TriangleSmoother smoother(src, dst, radius, &buffer[0], range.start);
+
+    for (int y = range.start; y < range.end; ++y)
+        smoother.row(y);
+}
+
+void smoothTriangle(const cv::Mat &src, cv::Mat &dst1, const int radius1,
+    cv::Mat &dst2, const int radius2, std::vector <float> &buffer, const cv::Range &rows)
+{
+    const cv::Range range = smoothedRows(src, dst1, rows);
+    smoothedRows(src, dst2, rows);
+
+    if (range.start == range.end)
+        return;
+
+    const size_t size1 = TriangleSmoother::scratchSize(src, radius1);
+    buffer.resize(size1 + TriangleSmoother::scratchSize(src, radius2));
+
+    TriangleSmoother smoother1(src, dst1, radius1, &buffer[0], range.start);
+    TriangleSmoother smoother2(src, dst2, radius2, &buffer[size1], range.start);
+
+    for (int y = range.start; y < range.end; ++y)
+    {
+        smoother1.row(y);
+        smoother2.row(y);
+    }
+    // rows of src are read by both while in cache
+}
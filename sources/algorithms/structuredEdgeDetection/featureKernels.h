@@ -0,0 +1,51 @@
+/**
+*  \file featureKernels.h
+*  \brief single pass kernels of feature extraction, scalar code with SSE2 where available
+*/
+
+#ifndef featureKernels_H
+#define featureKernels_H
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#if defined(WITH_SIMD) && (defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#  define FEATURE_KERNELS_SSE2
+#endif
+
+// buffer arguments are scratch memory grown as needed, passing
+// the same one to every call avoids allocations after the first,
+// kernels given rows compute only those rows of outputs allocated
+// beforehand, so bands of rows can be computed in parallel with
+// the results of one call for all rows (up to rounding of running sums)
+
+void rgbToLab(const float *src, float *dst, const int count);
+// count interleaved sRGB pixels in [0, 1] (clamped) to Lab (D65)
+// as L/100, (a + 128)/255, (b + 128)/255, dst can be src
+
+void gradientMagnitudeOrientation(const cv::Mat &src, cv::Mat &magnitude, cv::Mat &bins,
+    const int numberOfBins, std::vector <float> &buffer, const cv::Range &rows = cv::Range::all());
+// 3x3 Sobel gradients of all channels of CV_32F src (reflected border), at every pixel
+// the channel with the largest gradient gives CV_32FC1 magnitude and CV_8UC1 orientation
+// bin floor(phase/(2*pi)*numberOfBins), phase in [0, 2*pi) as cv::phase gives it
+
+void orientationHistograms(const cv::Mat &magnitude, const cv::Mat &bins, const int numberOfBins,
+    const int cellSize, const cv::Size &size, std::vector <cv::Mat> &histograms,
+    std::vector <float> &buffer, const cv::Range &rows = cv::Range::all());
+// histograms[b] is CV_32FC1 plane of size with sums of magnitude over cellSize x cellSize
+// cells at pixels of orientation bin b (see gradientMagnitudeOrientation), pixels beyond
+// size*cellSize are ignored, rows are the ones of histograms
+
+void smoothTriangle(const cv::Mat &src, cv::Mat &dst, const int radius,
+    std::vector <float> &buffer, const cv::Range &rows = cv::Range::all());
+// two box filters of size 2*radius + 1 with reflected borders (a triangle filter)
+// over all channels of CV_32F src at once, running sums, dst sharing src is reallocated
+// (not allowed with rows)
+
+void smoothTriangle(const cv::Mat &src, cv::Mat &dst1, const int radius1,
+    cv::Mat &dst2, const int radius2, std::vector <float> &buffer,
+    const cv::Range &rows = cv::Range::all());
+// both smoothings in one sweep over src
+
+#endif
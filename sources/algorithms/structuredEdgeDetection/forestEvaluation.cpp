@@ -0,0 +1,95 @@
+#include "forestEvaluation.h"
+
+#ifdef HAVE_AVX2
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  else
+#    include <cpuid.h>
+#  endif
+
+static bool detectAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    unsigned int a, b, c, d;
+
+    if (__get_cpuid_max(0, 0) < 7)
+        return false;
+
+    __cpuid(1, a, b, c, d);
+    bool osxsave = (c & (1 << 27)) != 0, avx = (c & (1 << 28)) != 0;
+    if (!osxsave || !avx)
+        return false;
+
+    unsigned int xcr0, xcr0High;
+    __asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0High) : "c" (0));
+    if ((xcr0 & 6) != 6)
+        return false;
+
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & (1 << 5)) != 0;
+#endif
+}
+// CPU and OS support of AVX2 (YMM state saved by the OS),
+// cv::checkHardwareSupport of OpenCV 2.4 does not know it
+
+static const bool hasAVX2 = detectAVX2();
+#endif
+
+void evaluateTreesScalar(const CompiledNode *nodes,
+    const float *regFeatures, const float *ssFeatures,
+    const int *roots, const int *offsets, const int count,
+    int *leaves, const int leavesStep)
+{
+    for (int n = 0; n < count; ++n)
+    {
+        int currentNode = roots[n];
+        int offset = offsets[n];
+
+        while (nodes[currentNode].child >= 0)
+        {
+            const CompiledNode &node = nodes[currentNode];
+
+            float currentFeature = node.offset2 < 0
+                ? regFeatures[offset + node.offset1]
+                : ssFeatures[offset + node.offset1] - ssFeatures[offset + node.offset2];
+
+            // compare feature to threshold and move left or right accordingly
+            currentNode = node.child + !(currentFeature < node.threshold);
+        }
+
+        leaves[n*leavesStep] = nodes[currentNode].offset1;
+    }
+}
+
+void evaluateTrees(const CompiledNode *nodes,
+    const float *regFeatures, const float *ssFeatures,
+    const int *roots, const int *offsets, const int count,
+    int *leaves, const int leavesStep, const int type)
+{
+    if (type == FOREST_EVALUATION_SIMD)
+    {
+#ifdef HAVE_AVX2
+        if (hasAVX2)
+            return evaluateTreesAVX2(nodes, regFeatures, ssFeatures,
+                roots, offsets, count, leaves, leavesStep);
+#endif
+    }
+    // without gathers (SSE4.1) lanes loaded one by one are no faster than scalar code
+
+    evaluateTreesScalar(nodes, regFeatures, ssFeatures,
+        roots, offsets, count, leaves, leavesStep);
+}
@@ -0,0 +1,75 @@
+/**
+*  \file forestEvaluation.h
+*  \brief evaluation of compiled trees for a batch of patches, scalar and SIMD versions
+*/
+
+#ifndef forestEvaluation_H
+#define forestEvaluation_H
+
+#include "randomForest.h"
+
+enum ForestEvaluationType
+{
+    FOREST_EVALUATION_SCALAR = 0, // one patch through one tree at a time
+    FOREST_EVALUATION_SIMD,       // patches in lockstep with AVX2 where the CPU has it, scalar otherwise
+    FOREST_EVALUATION_QUICKSCORER // top levels of trees as bitvectors, see QuickScorerForest
+};
+
+void evaluateTrees(const CompiledNode *nodes,
+    const float *regFeatures, const float *ssFeatures,
+    const int *roots, const int *offsets, const int count,
+    int *leaves, const int leavesStep, const int type);
+// leaves[n*leavesStep] = leaf reached from roots[n] for patch at offsets[n],
+// results of all types are identical
+
+//----------------------------------------------------------
+// QuickScorer (Lucchese et al., SIGIR 2015) for the top levels of every tree:
+// nodes are grouped by feature and sorted by threshold, each node keeps
+// a bitvector of tree exits still reachable when its test is false
+// (feature >= threshold), so the exit of a patch is the lowest bit
+// left after AND-ing masks of all false nodes, found by scanning
+// thresholds of each feature in ascending order. The trees are much larger
+// than 64 leaves, so below the exits traversal continues node by node.
+
+#define QUICKSCORER_MAX_EXITS 64
+
+struct QuickScorerForest
+{
+    int numberOfTreeNodes;
+    int levels;                        // levels of each tree evaluated with bitvectors
+
+    std::vector <int> treeFeatures;    // features of tree t are [treeFeatures[t], treeFeatures[t + 1])
+    std::vector <int> featureOffset1;  // feature offsets as in CompiledNode
+    std::vector <int> featureOffset2;
+
+    std::vector <int> featureNodes;    // nodes of feature f are [featureNodes[f], featureNodes[f + 1])
+    std::vector <float> thresholds;    // ascending within a feature
+    std::vector <uint64> masks;        // exits reachable if the node test is false
+
+    std::vector <int> exits;           // exit e of tree t is node exits[t*QUICKSCORER_MAX_EXITS + e]
+};
+
+void buildQuickScorer(const CompiledForest &forest, const int numberOfTrees,
+    const int numberOfTreeNodes, QuickScorerForest &quickScorer, const int levels = 6);
+// levels <= 6 keeps the number of exits of a tree within QUICKSCORER_MAX_EXITS
+
+void evaluateTreesQuickScorer(const CompiledNode *nodes, const QuickScorerForest &quickScorer,
+    const float *regFeatures, const float *ssFeatures,
+    const int *roots, const int *offsets, const int count,
+    int *leaves, const int leavesStep);
+// same contract and results as evaluateTrees
+
+//----------------------------------------------------------
+// per instruction set implementations, count is processed completely
+
+void evaluateTreesScalar(const CompiledNode *nodes,
+    const float *regFeatures, const float *ssFeatures,
+    const int *roots, const int *offsets, const int count,
+    int *leaves, const int leavesStep);
+
+void evaluateTreesAVX2(const CompiledNode *nodes,
+    const float *regFeatures, const float *ssFeatures,
+    const int *roots, const int *offsets, const int count,
+    int *leaves, const int leavesStep);
+
+#endif
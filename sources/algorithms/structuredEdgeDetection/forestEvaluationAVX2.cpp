@@ -0,0 +1,71 @@
+#include "forestEvaluation.h"
+
+#include <immintrin.h>
+
+// 8 patches advance one level per iteration; lanes that reached a leaf
+// keep their node and read nothing from the feature arrays
+
+void evaluateTreesAVX2(const CompiledNode *nodes,
+    const float *regFeatures, const float *ssFeatures,
+    const int *roots, const int *offsets, const int count,
+    int *leaves, const int leavesStep)
+{
+    const int *nodeFields = reinterpret_cast<const int *>(nodes);
+    const float *thresholds = reinterpret_cast<const float *>(nodes) + 3;
+    // CompiledNode is {child, offset1, offset2, threshold}
+
+    const __m256i minusOne = _mm256_set1_epi32(-1);
+
+    int n = 0;
+    for (; n + 8 <= count; n += 8)
+    {
+        __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(roots + n));
+        __m256i offset = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(offsets + n));
+
+        for (;;)
+        {
+            __m256i field = _mm256_slli_epi32(current, 2);
+
+            __m256i child = _mm256_i32gather_epi32(nodeFields, field, 4);
+            __m256i active = _mm256_cmpgt_epi32(child, minusOne);
+
+            if (_mm256_testz_si256(active, active))
+                break;
+
+            __m256i offset1 = _mm256_add_epi32(offset,
+                _mm256_i32gather_epi32(nodeFields + 1, field, 4));
+            __m256i offset2 = _mm256_i32gather_epi32(nodeFields + 2, field, 4);
+            __m256 threshold = _mm256_i32gather_ps(thresholds, field, 4);
+
+            __m256i selfSimilarity = _mm256_and_si256(active, _mm256_cmpgt_epi32(offset2, minusOne));
+            __m256i regular = _mm256_andnot_si256(selfSimilarity, active);
+            offset2 = _mm256_add_epi32(offset, offset2);
+
+            __m256 A = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), regFeatures,
+                offset1, _mm256_castsi256_ps(regular), 4);
+            __m256 B = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), ssFeatures,
+                offset1, _mm256_castsi256_ps(selfSimilarity), 4);
+            __m256 C = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), ssFeatures,
+                offset2, _mm256_castsi256_ps(selfSimilarity), 4);
+
+            __m256 feature = _mm256_blendv_ps(A, _mm256_sub_ps(B, C),
+                _mm256_castsi256_ps(selfSimilarity));
+
+            // !(feature < threshold), true for NaN as in the scalar version
+            __m256i right = _mm256_castps_si256(_mm256_cmp_ps(feature, threshold, _CMP_NLT_UQ));
+            __m256i next = _mm256_sub_epi32(child, right);
+
+            current = _mm256_blendv_epi8(current, next, active);
+        }
+
+        __m256i leaf = _mm256_i32gather_epi32(nodeFields + 1, _mm256_slli_epi32(current, 2), 4);
+
+        int result[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(result), leaf);
+        for (int k = 0; k < 8; ++k)
+            leaves[(n + k)*leavesStep] = result[k];
+    }
+
+    evaluateTreesScalar(nodes, regFeatures, ssFeatures,
+        roots + n, offsets + n, count - n, leaves + n*leavesStep, leavesStep);
+}
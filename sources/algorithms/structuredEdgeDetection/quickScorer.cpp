@@ -0,0 +1,165 @@
+#include "forestEvaluation.h"
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
+static inline int lowestBit(const uint64 v)
+{
+#if defined __GNUC__
+    return __builtin_ctzll(v);
+#elif defined _MSC_VER && defined _M_X64
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return int(index);
+#else
+    int index = 0;
+    while (!((v >> index) & 1))
+        ++index;
+    return index;
+#endif
+}
+
+struct DecisionNode
+{
+    int offset1, offset2;
+    float threshold;
+    uint64 mask;
+
+    bool operator < (const DecisionNode &other) const
+    {
+        if (offset1 != other.offset1)
+            return offset1 < other.offset1;
+        if (offset2 != other.offset2)
+            return offset2 < other.offset2;
+        return threshold < other.threshold;
+    }
+};
+
+static void collectExits(const CompiledForest &forest, const int node,
+    const int depth, const int levels, std::vector <int> &exits,
+    std::vector <DecisionNode> &decisions)
+{
+    if (forest[node].child < 0 || depth == levels)
+    {
+        exits.push_back(node);
+        return;
+    }
+
+    int first = int(exits.size());
+    collectExits(forest, forest[node].child, depth + 1, levels, exits, decisions);
+    int last = int(exits.size());
+    // exits in the left subtree, unreachable if the test is false
+
+    DecisionNode decision;
+    decision.offset1 = forest[node].offset1;
+    decision.offset2 = forest[node].offset2;
+    decision.threshold = forest[node].threshold;
+    decision.mask = ~(((uint64(1) << (last - first)) - 1) << first);
+    decisions.push_back(decision);
+
+    collectExits(forest, forest[node].child + 1, depth + 1, levels, exits, decisions);
+}
+
+void buildQuickScorer(const CompiledForest &forest, const int numberOfTrees,
+    const int numberOfTreeNodes, QuickScorerForest &quickScorer, const int levels)
+{
+    CV_Assert( levels >= 0 && (1 << levels) <= QUICKSCORER_MAX_EXITS );
+
+    quickScorer.numberOfTreeNodes = numberOfTreeNodes;
+    quickScorer.levels = levels;
+
+    quickScorer.treeFeatures.assign(1, 0);
+    quickScorer.featureOffset1.clear();
+    quickScorer.featureOffset2.clear();
+    quickScorer.featureNodes.assign(1, 0);
+    quickScorer.thresholds.clear();
+    quickScorer.masks.clear();
+    quickScorer.exits.assign(numberOfTrees*QUICKSCORER_MAX_EXITS, -1);
+
+    std::vector <int> exits;
+    std::vector <DecisionNode> decisions;
+
+    for (int t = 0; t < numberOfTrees; ++t)
+    {
+        exits.clear();
+        decisions.clear();
+        collectExits(forest, t*numberOfTreeNodes, 0, levels, exits, decisions);
+
+        std::copy(exits.begin(), exits.end(),
+            quickScorer.exits.begin() + t*QUICKSCORER_MAX_EXITS);
+
+        std::sort(decisions.begin(), decisions.end());
+
+        for (size_t k = 0; k < decisions.size(); ++k)
+        {
+            if (k > 0 && decisions[k].offset1 == decisions[k - 1].offset1
+                      && decisions[k].offset2 == decisions[k - 1].offset2)
+                quickScorer.featureNodes.pop_back();
+            else
+            {
+                quickScorer.featureOffset1.push_back(decisions[k].offset1);
+                quickScorer.featureOffset2.push_back(decisions[k].offset2);
+            }
+            // same feature as the previous node, extend its range instead
+
+            quickScorer.thresholds.push_back(decisions[k].threshold);
+            quickScorer.masks.push_back(decisions[k].mask);
+            quickScorer.featureNodes.push_back(int(quickScorer.thresholds.size()));
+        }
+
+        quickScorer.treeFeatures.push_back(int(quickScorer.featureOffset1.size()));
+    }
+}
+
+void evaluateTreesQuickScorer(const CompiledNode *nodes, const QuickScorerForest &quickScorer,
+    const float *regFeatures, const float *ssFeatures,
+    const int *roots, const int *offsets, const int count,
+    int *leaves, const int leavesStep)
+{
+    const int *treeFeatures = &quickScorer.treeFeatures[0];
+    const int *featureNodes = &quickScorer.featureNodes[0];
+    const float *thresholds = quickScorer.thresholds.empty() ? 0 : &quickScorer.thresholds[0];
+    const uint64 *masks = quickScorer.masks.empty() ? 0 : &quickScorer.masks[0];
+
+    for (int n = 0; n < count; ++n)
+    {
+        const int tree = roots[n] / quickScorer.numberOfTreeNodes;
+        const float *regPtr = regFeatures + offsets[n];
+        const float *ssPtr  = ssFeatures + offsets[n];
+
+        uint64 reachable = ~uint64(0);
+
+        for (int f = treeFeatures[tree]; f < treeFeatures[tree + 1]; ++f)
+        {
+            int offset1 = quickScorer.featureOffset1[f];
+            int offset2 = quickScorer.featureOffset2[f];
+
+            float currentFeature = offset2 < 0
+                ? regPtr[offset1]
+                : ssPtr[offset1] - ssPtr[offset2];
+
+            // false nodes are those with !(feature < threshold), all leading ones
+            for (int m = featureNodes[f]; m < featureNodes[f + 1]
+                && !(currentFeature < thresholds[m]); ++m)
+                reachable &= masks[m];
+        }
+
+        int currentNode = quickScorer.exits[tree*QUICKSCORER_MAX_EXITS + lowestBit(reachable)];
+
+        while (nodes[currentNode].child >= 0)
+        {
+            const CompiledNode &node = nodes[currentNode];
+
+            float currentFeature = node.offset2 < 0
+                ? regPtr[node.offset1]
+                : ssPtr[node.offset1] - ssPtr[node.offset2];
+
+            currentNode = node.child + !(currentFeature < node.threshold);
+        }
+
+        leaves[n*leavesStep] = nodes[currentNode].offset1;
+    }
+}
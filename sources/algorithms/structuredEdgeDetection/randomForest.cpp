@@ -0,0 +1,467 @@
+#include "randomForest.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+#ifdef _WIN32
+#  ifndef NOMINMAX
+#    define NOMINMAX
+#  endif
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+struct YamlForestStorage : public ForestStorage
+{
+    std::vector <int> featureIds;
+    std::vector <float> thresholds;
+    std::vector <int> childs;
+
+    std::vector <int> edgeBoundaries;
+    std::vector <int> edgeBins;
+};
+
+struct MappedForestStorage : public ForestStorage
+{
+    const void *data;
+    size_t size;
+
+#ifdef _WIN32
+    HANDLE file, mapping;
+#endif
+
+    MappedForestStorage(const std::string &filename);
+    virtual ~MappedForestStorage();
+};
+
+#ifdef _WIN32
+
+MappedForestStorage::MappedForestStorage(const std::string &filename)
+    : data(0), size(0), file(INVALID_HANDLE_VALUE), mapping(0)
+{
+    file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        CV_Error(CV_StsError, "can't open model file " + filename);
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    size = size_t(fileSize.QuadPart);
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping != 0)
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (data == 0)
+    {
+        if (mapping != 0)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        CV_Error(CV_StsError, "can't map model file " + filename);
+    }
+}
+
+MappedForestStorage::~MappedForestStorage()
+{
+    UnmapViewOfFile(data);
+    CloseHandle(mapping);
+    CloseHandle(file);
+}
+
+#else
+
+MappedForestStorage::MappedForestStorage(const std::string &filename)
+    : data(0), size(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        CV_Error(CV_StsError, "can't open model file " + filename);
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0)
+    {
+        close(fd);
+        CV_Error(CV_StsError, "can't stat model file " + filename);
+    }
+    size = size_t(fileStat.st_size);
+
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // mapping stays valid after the descriptor is closed
+
+    if (mapped == MAP_FAILED)
+        CV_Error(CV_StsError, "can't map model file " + filename);
+
+    data = mapped;
+}
+
+MappedForestStorage::~MappedForestStorage()
+{
+    munmap(const_cast<void *>(data), size);
+}
+
+#endif
+
+//----------------------------------------------------------
+
+template <typename _Tp> static void readYamlTrees
+    (const cv::FileNode &trees, std::vector <_Tp> &dst)
+{
+    std::vector <_Tp> currentTree;
+
+    for(cv::FileNodeIterator it = trees.begin();
+        it != trees.end(); ++it)
+    {
+        (*it) >> currentTree;
+        std::copy(currentTree.begin(), currentTree.end(),
+            std::back_inserter(dst));
+    }
+}
+
+void loadYamlForest(const std::string &filename, RandomForest &rf)
+{
+    cv::FileStorage modelFile(filename, cv::FileStorage::READ);
+    CV_Assert( modelFile.isOpened() );
+
+    rf.options.stride = modelFile["options"]["stride"];
+    rf.options.shrinkNumber = modelFile["options"]["shrinkNumber"];
+    rf.options.patchSize = modelFile["options"]["patchSize"];
+    rf.options.patchInnerSize = modelFile["options"]["patchInnerSize"];
+
+    rf.options.numberOfGradientOrientations = modelFile["options"]["numberOfGradientOrientations"];
+    rf.options.gradientSmoothingRadius = modelFile["options"]["gradientSmoothingRadius"];
+    rf.options.regFeatureSmoothingRadius = modelFile["options"]["regFeatureSmoothingRadius"];
+    rf.options.ssFeatureSmoothingRadius = modelFile["options"]["ssFeatureSmoothingRadius"];
+    rf.options.gradientNormalizationRadius = modelFile["options"]["gradientNormalizationRadius"];
+
+    rf.options.selfsimilarityGridSize = modelFile["options"]["selfsimilarityGridSize"];
+
+    rf.options.numberOfTrees = modelFile["options"]["numberOfTrees"];
+    rf.options.numberOfTreesToEvaluate = modelFile["options"]["numberOfTreesToEvaluate"];
+
+    rf.options.numberOfOutputChannels =
+        2*(rf.options.numberOfGradientOrientations + 1) + 3;
+    //--------------------------------------------
+
+    YamlForestStorage *storage = new YamlForestStorage;
+    cv::Ptr <ForestStorage> storageOwner(storage);
+
+    readYamlTrees(modelFile["childs"], storage->childs);
+    readYamlTrees(modelFile["featureIds"], storage->featureIds);
+    readYamlTrees(modelFile["thresholds"], storage->thresholds);
+
+    readYamlTrees(modelFile["edgeBoundaries"], storage->edgeBoundaries);
+    readYamlTrees(modelFile["edgeBins"], storage->edgeBins);
+
+    rf.childs = storage->childs;
+    rf.featureIds = storage->featureIds;
+    rf.thresholds = storage->thresholds;
+    rf.edgeBoundaries = storage->edgeBoundaries;
+    rf.edgeBins = storage->edgeBins;
+    rf.storage = storageOwner;
+
+    if (rf.options.numberOfTrees <= 0)
+        CV_Error(CV_StsBadArg, "invalid model options");
+    rf.numberOfTreeNodes = int( rf.childs.size() ) / rf.options.numberOfTrees;
+
+    validateForest(rf);
+    // packForest and detection index the arrays without further checks
+}
+
+//----------------------------------------------------------
+
+bool isBinaryForest(const std::string &filename)
+{
+    char magic[sizeof(BINARY_FOREST_MAGIC)] = {0};
+
+    std::ifstream modelFile(filename.c_str(), std::ios::binary);
+    modelFile.read(magic, sizeof(magic));
+
+    return modelFile.good()
+        && std::memcmp(magic, BINARY_FOREST_MAGIC, sizeof(magic)) == 0;
+}
+
+template <typename _Tp> static ForestArray <_Tp> mapSection
+    (const MappedForestStorage &storage, const BinaryForestSection &section)
+{
+    if (section.length == 0)
+        return ForestArray <_Tp>();
+
+    if ( section.offset < int64(sizeof(BinaryForestHeader))
+      || section.offset % BINARY_FOREST_ALIGNMENT != 0
+      || section.length < 0
+      || section.length > (int64(storage.size) - section.offset) / int64(sizeof(_Tp)) )
+        CV_Error(CV_StsParseError, "corrupted binary model: bad section bounds");
+
+    const char *begin = static_cast<const char *>(storage.data) + section.offset;
+    return ForestArray <_Tp>(reinterpret_cast<const _Tp *>(begin), size_t(section.length));
+}
+
+void loadBinaryForest(const std::string &filename, RandomForest &rf)
+{
+    MappedForestStorage *storage = new MappedForestStorage(filename);
+    cv::Ptr <ForestStorage> storageOwner(storage);
+
+    if (storage->size < sizeof(BinaryForestHeader))
+        CV_Error(CV_StsParseError, "corrupted binary model: truncated header");
+
+    const BinaryForestHeader &header =
+        *static_cast<const BinaryForestHeader *>(storage->data);
+
+    if (std::memcmp(header.magic, BINARY_FOREST_MAGIC, sizeof(BINARY_FOREST_MAGIC)) != 0)
+        CV_Error(CV_StsParseError, "not a binary model: " + filename);
+    if (header.version != BINARY_FOREST_VERSION)
+        CV_Error(CV_StsParseError, "unsupported binary model version: " + filename);
+    if (header.byteOrder != BINARY_FOREST_BYTE_ORDER)
+        CV_Error(CV_StsParseError, "binary model has foreign byte order: " + filename);
+
+    rf.options = header.options;
+    rf.numberOfTreeNodes = header.numberOfTreeNodes;
+    rf.storage = storageOwner;
+
+    rf.childs = mapSection<int>(*storage, header.sections[SECTION_CHILDS]);
+    rf.featureIds = mapSection<int>(*storage, header.sections[SECTION_FEATURE_IDS]);
+    rf.thresholds = mapSection<float>(*storage, header.sections[SECTION_THRESHOLDS]);
+    rf.edgeBoundaries = mapSection<int>(*storage, header.sections[SECTION_EDGE_BOUNDARIES]);
+    rf.edgeBins = mapSection<int>(*storage, header.sections[SECTION_EDGE_BINS]);
+
+    validateForest(rf);
+    // reads childs and featureIds only, edgeBins were scanned
+    // by validateEdges when sedCompileModel wrote the model
+}
+
+template <typename _Tp> static void writeSection
+    (std::ofstream &modelFile, BinaryForestSection &section, const ForestArray <_Tp> &src)
+{
+    static const char padding[BINARY_FOREST_ALIGNMENT] = {0};
+
+    int64 position = int64(modelFile.tellp());
+    int64 alignedPosition = (position + BINARY_FOREST_ALIGNMENT - 1)
+        / BINARY_FOREST_ALIGNMENT * BINARY_FOREST_ALIGNMENT;
+    modelFile.write(padding, std::streamsize(alignedPosition - position));
+
+    section.offset = alignedPosition;
+    section.length = int64(src.size());
+
+    if (!src.empty())
+        modelFile.write(reinterpret_cast<const char *>(src.data),
+            std::streamsize(src.size()*sizeof(_Tp)));
+}
+
+void saveBinaryForest(const std::string &filename, const RandomForest &rf)
+{
+    std::ofstream modelFile(filename.c_str(), std::ios::binary | std::ios::trunc);
+    if (!modelFile.is_open())
+        CV_Error(CV_StsError, "can't open " + filename + " for writing");
+
+    BinaryForestHeader header;
+    std::memset(&header, 0, sizeof(header));
+
+    std::memcpy(header.magic, BINARY_FOREST_MAGIC, sizeof(BINARY_FOREST_MAGIC));
+    header.version = BINARY_FOREST_VERSION;
+    header.byteOrder = BINARY_FOREST_BYTE_ORDER;
+    header.options = rf.options;
+    header.numberOfTreeNodes = rf.numberOfTreeNodes;
+
+    modelFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    // placeholder, rewritten once section offsets are known
+
+    writeSection(modelFile, header.sections[SECTION_CHILDS], rf.childs);
+    writeSection(modelFile, header.sections[SECTION_FEATURE_IDS], rf.featureIds);
+    writeSection(modelFile, header.sections[SECTION_THRESHOLDS], rf.thresholds);
+    writeSection(modelFile, header.sections[SECTION_EDGE_BOUNDARIES], rf.edgeBoundaries);
+    writeSection(modelFile, header.sections[SECTION_EDGE_BINS], rf.edgeBins);
+
+    modelFile.seekp(0);
+    modelFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    if (!modelFile.good())
+        CV_Error(CV_StsError, "can't write " + filename);
+}
+
+void loadForest(const std::string &filename, RandomForest &rf)
+{
+    if (isBinaryForest(filename))
+        loadBinaryForest(filename, rf);
+    else
+        loadYamlForest(filename, rf);
+}
+
+//----------------------------------------------------------
+
+void validateForest(const RandomForest &rf)
+{
+    const RandomForestOptions &opt = rf.options;
+
+    if (opt.numberOfTrees <= 0 || opt.shrinkNumber <= 0 || opt.stride <= 0
+        || opt.patchSize <= 0 || opt.patchInnerSize <= 0
+        || opt.numberOfTreesToEvaluate <= 0 || opt.numberOfTreesToEvaluate > opt.numberOfTrees)
+        CV_Error(CV_StsBadArg, "invalid model options");
+
+    if (rf.numberOfTreeNodes <= 0
+        || size_t(rf.numberOfTreeNodes) * opt.numberOfTrees != rf.childs.size())
+        CV_Error(CV_StsBadSize, cv::format("numberOfTreeNodes (%d) x numberOfTrees (%d) != %d nodes",
+            rf.numberOfTreeNodes, opt.numberOfTrees, int(rf.childs.size())));
+
+    if (rf.featureIds.size() != rf.childs.size() || rf.thresholds.size() != rf.childs.size())
+        CV_Error(CV_StsBadSize, "childs, featureIds and thresholds differ in size");
+
+    const int channels = opt.numberOfOutputChannels;
+    const int gridCells = CV_SQR(opt.selfsimilarityGridSize);
+
+    const int nFeatures = CV_SQR(opt.patchSize/opt.shrinkNumber)*channels;
+    const int nSsFeatures = gridCells*(gridCells - 1)/2*channels;
+
+    for (int t = 0; t < opt.numberOfTrees; ++t)
+    {
+        const int first = t*rf.numberOfTreeNodes;
+        const int last  = first + rf.numberOfTreeNodes;
+
+        for (int k = first; k < last; ++k)
+        {
+            if (rf.childs[k] == 0)
+                continue;
+
+            if (rf.childs[k] - 1 <= k || rf.childs[k] >= last)
+                CV_Error(CV_StsOutOfRange, cv::format("tree %d: node %d has child %d outside of [%d, %d)",
+                    t, k, rf.childs[k], k + 2, last));
+
+            if (rf.featureIds[k] < 0 || rf.featureIds[k] >= nFeatures + nSsFeatures)
+                CV_Error(CV_StsOutOfRange, cv::format("tree %d: node %d has feature id %d outside of [0, %d)",
+                    t, k, rf.featureIds[k], nFeatures + nSsFeatures));
+        }
+    }
+
+    if (rf.edgeBoundaries.empty())
+        return;
+
+    if (rf.edgeBoundaries.size() < rf.childs.size() + 1
+        || (rf.edgeBoundaries.size() - 1) % rf.childs.size() != 0)
+        CV_Error(CV_StsBadSize, "edgeBoundaries doesn't match number of nodes");
+
+    if (rf.edgeBoundaries[0] != 0)
+        CV_Error(CV_StsBadArg, "edgeBoundaries don't start at 0");
+
+    if (size_t(rf.edgeBoundaries[rf.edgeBoundaries.size() - 1]) != rf.edgeBins.size())
+        CV_Error(CV_StsBadSize, "edgeBoundaries doesn't match number of edgeBins");
+}
+
+void validateEdges(const RandomForest &rf)
+{
+    validateForest(rf);
+
+    for (size_t k = 1; k < rf.edgeBoundaries.size(); ++k)
+        if (rf.edgeBoundaries[k] < rf.edgeBoundaries[k - 1])
+            CV_Error(CV_StsBadArg, "edgeBoundaries are not sorted");
+
+    for (size_t k = 0; k < rf.edgeBins.size(); ++k)
+        if (rf.edgeBins[k] < 0 || rf.edgeBins[k] >= CV_SQR(rf.options.patchInnerSize))
+            CV_Error(CV_StsOutOfRange, "edge bin outside of the inner patch");
+}
+
+//----------------------------------------------------------
+
+void packForest(const RandomForest &rf, std::vector <PackedNode> &nodes)
+{
+    nodes.resize(rf.childs.size());
+
+    for (size_t k = 0; k < rf.childs.size(); ++k)
+    {
+        if (rf.childs[k] == 0)
+        {
+            nodes[k].child = -1;
+            nodes[k].featureId = int(k);
+            nodes[k].threshold = 0.0f;
+        }
+        else
+        {
+            nodes[k].child = rf.childs[k] - 1;
+            nodes[k].featureId = rf.featureIds[k];
+            nodes[k].threshold = rf.thresholds[k];
+        }
+    }
+}
+
+static void placeChildren(const PackedNode &node, const int base,
+    std::vector <int> &newIndex, int &placed)
+{
+    newIndex[node.child - base] = placed++;
+    newIndex[node.child - base + 1] = placed++;
+}
+// siblings are always placed next to each other
+
+void reorderPackedForest(const RandomForest &rf, std::vector <PackedNode> &nodes,
+    const int breadthFirstLevels)
+{
+    const int nTreesNodes = rf.numberOfTreeNodes;
+
+    std::vector <PackedNode> tree(nTreesNodes);
+    std::vector <int> newIndex(nTreesNodes);
+    // tree-relative, -1 for nodes not placed yet
+
+    std::vector <int> level, nextLevel, stack;
+
+    for (int t = 0; t < rf.options.numberOfTrees; ++t)
+    {
+        PackedNode *src = &nodes[t*nTreesNodes];
+        const int base = t*nTreesNodes;
+
+        std::fill(newIndex.begin(), newIndex.end(), -1);
+
+        int placed = 0;
+        newIndex[0] = placed++;
+
+        level.assign(1, 0);
+        for (int depth = 0; depth < breadthFirstLevels && !level.empty(); ++depth)
+        {
+            nextLevel.clear();
+            for (size_t i = 0; i < level.size(); ++i)
+                if (src[level[i]].child >= 0)
+                {
+                    placeChildren(src[level[i]], base, newIndex, placed);
+                    nextLevel.push_back(src[level[i]].child - base);
+                    nextLevel.push_back(src[level[i]].child - base + 1);
+                }
+            level.swap(nextLevel);
+        }
+
+        for (size_t i = 0; i < level.size(); ++i)
+        {
+            stack.assign(1, level[i]);
+            while (!stack.empty())
+            {
+                int k = stack.back();
+                stack.pop_back();
+
+                if (src[k].child < 0)
+                    continue;
+
+                placeChildren(src[k], base, newIndex, placed);
+                stack.push_back(src[k].child - base + 1);
+                stack.push_back(src[k].child - base);
+                // left subtree is laid out first, right one after it
+            }
+        }
+
+        for (int k = 0; k < nTreesNodes; ++k)
+            if (newIndex[k] < 0)
+                newIndex[k] = placed++;
+        // nodes unreachable from the root (padding of smaller trees) go last
+
+        for (int k = 0; k < nTreesNodes; ++k)
+        {
+            PackedNode &node = tree[newIndex[k]];
+
+            node = src[k];
+            if (node.child >= 0)
+                node.child = base + newIndex[node.child - base];
+        }
+
+        std::copy(tree.begin(), tree.end(), src);
+    }
+}
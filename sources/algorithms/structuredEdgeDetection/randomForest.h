@@ -0,0 +1,192 @@
+/**
+*  \file randomForest.h
+*  \brief random forest model used by structured edge detection and its on-disk formats
+*/
+
+#ifndef randomForest_H
+#define randomForest_H
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#ifndef CV_SQR
+#  define CV_SQR(x)  ((x)*(x))
+#endif
+
+struct RandomForestOptions
+{
+    //----------------------------------------------------------
+    // model params
+
+    int numberOfOutputChannels; // number of edge orientation bins for output
+
+    int patchSize;      // width of image patches
+    int patchInnerSize; // width of patch predicted part
+    //----------------------------------------------------------
+
+    // feature params
+
+    int regFeatureSmoothingRadius;    // radius for smoothing of regular features
+    // (using convolution with triangle filter
+
+    int ssFeatureSmoothingRadius;     // radius for smoothing of additional features
+    // (using convolution with triangle filter)
+
+    int shrinkNumber;                 // amount to shrink channels
+
+    int numberOfGradientOrientations; // number of orientations per gradient scale
+
+    int gradientSmoothingRadius;      // radius for smoothing of gradients
+    // (using convolution with triangle filter)
+
+    int gradientNormalizationRadius;  // gradient normalization radius
+    int selfsimilarityGridSize;       // number of self similarity cells
+
+    //----------------------------------------------------------
+    // detection params
+
+    int numberOfTrees;            // number of trees in forest to train
+    int numberOfTreesToEvaluate;  // number of trees to evaluate per location
+
+    int stride;                   // stride at which to compute edges
+};
+
+template <typename _Tp> struct ForestArray
+{
+    const _Tp *data;
+    size_t length;
+
+    ForestArray() : data(0), length(0) {}
+    ForestArray(const _Tp *_data, size_t _length) : data(_data), length(_length) {}
+    ForestArray(const std::vector <_Tp> &vec)
+        : data(vec.empty() ? 0 : &vec[0]), length(vec.size()) {}
+
+    const _Tp &operator [] (size_t i) const { return data[i]; }
+
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+};
+// read-only view of a forest array, memory is owned by RandomForest::storage
+
+struct ForestStorage
+{
+    virtual ~ForestStorage() {};
+};
+// owner of the memory RandomForest arrays point to
+// (heap vectors for YAML models, file mapping for binary ones)
+
+struct RandomForest
+{
+    RandomForestOptions options;
+
+    int numberOfTreeNodes;
+
+    ForestArray <int> featureIds;     // feature coordinate thresholded at k-th node
+    ForestArray <float> thresholds;   // threshold applied to featureIds[k] at k-th node
+    ForestArray <int> childs;         // k --> child[k] - 1, child[k]
+
+    ForestArray <int> edgeBoundaries; // ...
+    ForestArray <int> edgeBins;       // ...
+
+    cv::Ptr <ForestStorage> storage;
+};
+
+struct PackedNode
+{
+    int child;        // left child is child, right one is child + 1, -1 for leaves
+    int featureId;    // feature thresholded at the node, for leaves index of the node in RandomForest
+    float threshold;  // go left if feature < threshold
+};
+// node with all fields touched by traversal in one place
+
+void packForest(const RandomForest &rf, std::vector <PackedNode> &nodes);
+// build packed nodes of all rf trees, node k of rf is nodes[k]
+
+void reorderPackedForest(const RandomForest &rf, std::vector <PackedNode> &nodes,
+    const int breadthFirstLevels = 6);
+// relayout nodes of every tree for locality: first breadthFirstLevels levels
+// in breadth-first order, then each remaining subtree as one contiguous block,
+// roots, leaf indices and traversal results are preserved
+
+struct CompiledNode
+{
+    int child;        // as in PackedNode
+    int offset1;      // offset of the feature from the patch origin, node index for leaves
+    int offset2;      // offset of the subtrahend of self-similarity features, -1 for regular ones
+    float threshold;  // go left if feature < threshold
+};
+// packed node with feature id resolved for one feature image width
+
+typedef std::vector <CompiledNode> CompiledForest;
+
+//----------------------------------------------------------
+// Binary model format, version BINARY_FOREST_VERSION:
+//
+//   BinaryForestHeader, then the arrays listed in BinaryForestHeader::sections
+//   in native byte order, every array starting at a multiple of
+//   BINARY_FOREST_ALIGNMENT bytes from the beginning of the file,
+//   so that a mapping of the file can be used without any parsing.
+
+#define BINARY_FOREST_MAGIC     "SEDFRST"
+#define BINARY_FOREST_VERSION   1
+#define BINARY_FOREST_ALIGNMENT 64
+#define BINARY_FOREST_BYTE_ORDER 0x01020304
+
+enum BinaryForestSectionId
+{
+    SECTION_CHILDS = 0,
+    SECTION_FEATURE_IDS,
+    SECTION_THRESHOLDS,
+    SECTION_EDGE_BOUNDARIES,
+    SECTION_EDGE_BINS,
+
+    NUMBER_OF_SECTIONS
+};
+
+struct BinaryForestSection
+{
+    int64 offset; // in bytes from the beginning of the file
+    int64 length; // in elements
+};
+
+struct BinaryForestHeader
+{
+    char magic[8];      // BINARY_FOREST_MAGIC
+    int version;        // BINARY_FOREST_VERSION
+    int byteOrder;      // BINARY_FOREST_BYTE_ORDER as written by the producer
+
+    RandomForestOptions options;
+    int numberOfTreeNodes;
+    int reserved;
+
+    BinaryForestSection sections[NUMBER_OF_SECTIONS];
+};
+
+bool isBinaryForest(const std::string &filename);
+// check the magic number of filename
+
+void loadYamlForest(const std::string &filename, RandomForest &rf);
+// parse options and forest from YAML model (as exported from the original Matlab code),
+// validated with validateForest
+
+void loadBinaryForest(const std::string &filename, RandomForest &rf);
+// map binary model into memory, rf arrays point directly into the mapping,
+// header and section bounds checked, then validated with validateForest
+
+void saveBinaryForest(const std::string &filename, const RandomForest &rf);
+// write rf in the binary model format
+
+void loadForest(const std::string &filename, RandomForest &rf);
+// binary model if filename has one, YAML otherwise
+
+void validateForest(const RandomForest &rf);
+// check options, array sizes, child indices, feature ids and ends of edgeBoundaries,
+// O(nodes), throws cv::Exception
+
+void validateEdges(const RandomForest &rf);
+// validateForest plus order of edgeBoundaries and range of every edge bin,
+// O(nodes + edge bins), run by sedCompileModel so loading does not read edgeBins
+
+#endif
@@ -1,153 +1,517 @@
 #include "structuredEdgeDetection.h"
 
+#include <algorithm>
+#include <cmath>
+
 #include "../../opencv_size.h"
 
-cv::Mat StructuredEdgeDetection::__imresize
-    (const cv::Mat &img, const cv::Size &sizeDst)
+void StructuredEdgeDetection::__imresize
+    (const cv::Mat &img, const cv::Size &sizeDst, cv::Mat &dst)
 {
     int resizeType = sizeDst <= img.size()
         ? cv::INTER_AREA
         : cv::INTER_LINEAR;
 
-    cv::Mat res;
-
     if (sizeDst != img.size())
     {
-        cv::resize(img, res, sizeDst, 0.0f, 0.0f, resizeType);
-        return res.clone();
+        if (dst.data == img.data)
+            dst.release();
+        cv::resize(img, dst, sizeDst, 0.0f, 0.0f, resizeType);
     }
     else
-        return img.clone();
+        dst = img;
+}
+
+static int boxRadius(const int rad)
+{
+    int crad = CV_INC_IF_EVEN(2*rad/3);
+    return crad < 3 ? 0 : crad/2;
 }
+// half-width of each of the two box filters smoothing with radius rad,
+// the authors used triangle convolution, 0 means nothing to smooth
 
-cv::Mat StructuredEdgeDetection::__imsmooth
-    (const cv::Mat &img, const int rad)
+class LabConversionInvoker : public cv::ParallelLoopBody
 {
-    cv::Mat dst;
+public:
+    LabConversionInvoker(const cv::Mat &_img, cv::Mat &_labImg)
+        : img(_img), labImg(_labImg) {}
+
+    virtual void operator() (const cv::Range &range) const
+    {
+        for (int i = range.start; i < range.end; ++i)
+            rgbToLab(img.ptr<float>(i), labImg.ptr<float>(i), img.cols);
+    }
 
-    cv::Size crad(CV_INC_IF_EVEN(2*rad/3), CV_INC_IF_EVEN(2*rad/3));
-    if (crad < 3)
-        return img.clone();
+private:
+    const cv::Mat &img;
+    cv::Mat &labImg;
+};
+// rows are converted independently
 
-    cv::boxFilter(img, dst, -1, crad, cv::Point(-1,-1), true, cv::BORDER_REFLECT);
-    cv::boxFilter(dst, dst, -1, crad, cv::Point(-1,-1), true, cv::BORDER_REFLECT);
+void StructuredEdgeDetection::__rgbToLab(const cv::Mat &img, cv::Mat &labImg)
+{
+    CV_Assert( img.type() == CV_32FC3 );
+
+    labImg.create(img.size(), CV_32FC3);
 
-    return dst.clone();
+    LabConversionInvoker invoker(img, labImg);
+    cv::parallel_for_(cv::Range(0, img.rows), invoker, __parallelStripes());
 }
 
-void StructuredEdgeDetection::__imhog
-    (const cv::Mat &img, cv::Mat &magnitude, cv::Mat &histogram,
-    const int numberOfBins, const int sizeOfPatch, const int gnrmRad)
+template <typename _Tp> static void interleaveTransposed
+    (const std::vector <cv::Mat> &planes, const float scale, cv::Mat &dst)
 {
-    cv::Mat phase, Dx, Dy;
+    const int blockSize = 64;
+    // rows of dst written while reading columns of planes
+
+    for (int y0 = 0; y0 < dst.rows; y0 += blockSize)
+    {
+        const int y1 = std::min(y0 + blockSize, dst.rows);
+
+        for (int x = 0; x < dst.cols; ++x)
+            for (int c = 0; c < 3; ++c)
+            {
+                const _Tp *srcPtr = planes[c].ptr<_Tp>(x);
+
+                for (int y = y0; y < y1; ++y)
+                    dst.ptr<float>(y)[3*x + c] = srcPtr[y]*scale;
+            }
+    }
+}
 
-    cv::Sobel(img, Dx, cv::DataType<float>::type,
-        1, 0, 3, 1.0, 0.0, cv::BORDER_REFLECT);
-    cv::Sobel(img, Dy, cv::DataType<float>::type,
-        0, 1, 3, 1.0, 0.0, cv::BORDER_REFLECT);
+void StructuredEdgeDetection::__transposedPlanesToLab
+    (const std::vector <cv::Mat> &planes, const double scale, cv::Mat &labImg)
+{
+    CV_Assert( planes.size() == 3 );
+    for (int c = 0; c < 3; ++c)
+        CV_Assert( planes[c].size() == planes[0].size()
+            && planes[c].type() == planes[0].type() && planes[c].channels() == 1 );
 
-    cv::reduce(Dx.reshape(1, img.rows*img.cols), Dx, 1, CV_REDUCE_MAX, -1);
-    cv::reduce(Dy.reshape(1, img.rows*img.cols), Dy, 1, CV_REDUCE_MAX, -1);
+    labImg.create(planes[0].cols, planes[0].rows, CV_32FC3);
 
-    cv::phase(Dx.reshape(1, img.rows), Dy.reshape(1, img.rows), phase);
-    cv::magnitude(Dx.reshape(1, img.rows), Dy.reshape(1, img.rows), magnitude);
+    switch (planes[0].depth())
+    {
+    case CV_8U:
+        interleaveTransposed<uchar>(planes, float(scale/255), labImg);
+        break;
+    case CV_32F:
+        interleaveTransposed<float>(planes, float(scale/255), labImg);
+        break;
+    case CV_64F:
+        interleaveTransposed<double>(planes, float(scale/255), labImg);
+        break;
+    default:
+        CV_Error(CV_StsBadArg, "planes should be uint8, single or double");
+    }
+    // transposition, interleaving and scaling to [0, 1] in one pass
 
-    magnitude /= __imsmooth(magnitude, gnrmRad) + 0.1;
+    LabConversionInvoker invoker(labImg, labImg);
+    cv::parallel_for_(cv::Range(0, labImg.rows), invoker, __parallelStripes());
+    // in place, by the same row bands as __rgbToLab
+}
 
-    int histType = CV_MAKETYPE(cv::DataType<float>::type, numberOfBins);
-    histogram.create( img.size()/float(sizeOfPatch), histType );
+static const float gradientScales[] = {1.0f, 0.5f};
+static const int numberOfGradientScales = 2;
+// gradients of the image and of its half, relative to the image features are extracted from
 
-    histogram.setTo(0);
-    for (int i = 0; i < phase.rows; ++i)
+class WorkUnitsInvoker : public cv::ParallelLoopBody
+{
+public:
+    void add(const cv::Ptr <cv::ParallelLoopBody> &body, const int count, const int unitSize)
     {
-        float *histPtr = histogram.ptr<float>(i/sizeOfPatch);
-        const float *anglePtr  = phase.ptr<float>(i);
-        const float *lengthPtr = magnitude.ptr<float>(i);
+        bodies.push_back(body);
 
-        for (int j = 0; j < phase.cols; ++j)
+        for (int start = 0; start < count; start += unitSize)
         {
-            int index = cvFloor(/**/ ((j/sizeOfPatch)
-                + anglePtr[j]/(2*CV_PI))*numberOfBins /**/);
-            histPtr[index] += lengthPtr[j];
+            Unit unit = {body, cv::Range(start, std::min(start + unitSize, count))};
+            units.push_back(unit);
         }
     }
+    // range [0, count) of body split into units of unitSize
+
+    int size() const { return int(units.size()); };
+
+    virtual void operator() (const cv::Range &range) const
+    {
+        for (int k = range.start; k < range.end; ++k)
+            (*units[k].body)(units[k].range);
+    }
+
+private:
+    struct Unit
+    {
+        const cv::ParallelLoopBody *body;
+        cv::Range range;
+    };
+
+    std::vector <cv::Ptr <cv::ParallelLoopBody> > bodies;
+    std::vector <Unit> units;
+};
+// ranges of several loops run by one cv::parallel_for_, so a big scale
+// does not leave threads waiting while small ones are done
+
+static const int bandsPerThread = 4;
+// bands one loop of rows is split into per thread, enough for threads to
+// balance, few enough to keep warm-up of sliding kernels at band starts small
+
+static const int valuesPerUnit = 65536;
+// smallest band worth a unit of its own, in values of the rows computed
+
+static int numberOfBands()
+{
+    return bandsPerThread*std::max(1, cv::getNumThreads());
+}
+
+static int unitRows(const int rows, const int rowValues, const int nBands = numberOfBands())
+{
+    return std::max( (rows + nBands - 1) / nBands,
+        std::max(1, valuesPerUnit / std::max(rowValues, 1)) );
+}
+// rows of a unit, rows are split into at most nBands units
+
+static void prepareBands(DetectionWorkspace &workspace, const int numberOfLoops)
+{
+    workspace.numberOfBands = numberOfBands();
+
+    if (int(workspace.bandBuffers.size()) < numberOfLoops*workspace.numberOfBands)
+        workspace.bandBuffers.resize(numberOfLoops*workspace.numberOfBands);
+}
+// scratch of every band of numberOfLoops loops running at once,
+// kept as it is when there is enough
+
+class FeaturePassInvoker : public cv::ParallelLoopBody
+{
+public:
+    FeaturePassInvoker(StructuredEdgeDetection &_detector, const int _pass, const int _scale,
+        const int _bandRows, DetectionWorkspace &_workspace)
+        : detector(_detector), pass(_pass), scale(_scale), bandRows(_bandRows),
+          workspace(_workspace) {}
+
+    virtual void operator() (const cv::Range &range) const
+    {
+        detector.__featurePass(pass, scale, workspace, range, range.start / bandRows);
+    }
+
+private:
+    StructuredEdgeDetection &detector;
+    const int pass;
+    const int scale;
+    const int bandRows;
+
+    DetectionWorkspace &workspace;
+};
+// band of rows of one feature pass, scratch of the band is kept in workspace
+
+static void addFeaturePass(StructuredEdgeDetection &detector, const int pass,
+    DetectionWorkspace &workspace, WorkUnitsInvoker &units)
+{
+    int gradNum = detector.__rf.options.numberOfGradientOrientations;
+
+    for (int k = 0; k < numberOfGradientScales; ++k)
+    {
+        const GradientWorkspace &gradient = workspace.gradients[k];
+
+        int rowValues = gradient.magnitude.cols;
+        if (pass == FEATURE_PASS_HISTOGRAMS)
+            rowValues = gradient.histograms[0].cols*gradNum;
+        if (pass == FEATURE_PASS_MIXING)
+            rowValues = workspace.features.cols*workspace.features.channels();
+
+        int rows = detector.__featurePassRows(pass, k, workspace);
+        int size = unitRows(rows, rowValues, workspace.numberOfBands);
+
+        units.add(new FeaturePassInvoker(detector, pass, k, size, workspace), rows, size);
+    }
+}
+// units of pass for workspace prepared by __prepareFeatures
+
+static const cv::Mat &planeSource(const DetectionWorkspace &workspace, const int p,
+    const int numberOfBins)
+{
+    const GradientWorkspace &gradient = workspace.gradients[(p - 3) / (1 + numberOfBins)];
+    const int channel = (p - 3) % (1 + numberOfBins);
+
+    return channel == 0 ? gradient.magnitude : gradient.histograms[channel - 1];
+}
+// gradient plane p of workspace.planes before shrinking, magnitude
+// and histograms of every scale of gradients follow three Lab planes
+
+static void shrunkBuffer(const cv::Mat &src, const cv::Size &size, cv::Mat &dst)
+{
+    if (src.size() == size)
+        dst = src;
+    else
+    {
+        if (dst.data == src.data)
+            dst.release();
+        dst.create(size, src.type());
+    }
+}
+// dst of size shares data with src when sizes are the same, as with __imresize
+
+static bool shrinksByRows(const cv::Mat &src, const cv::Mat &dst)
+{
+    return src.data == dst.data || (dst.rows > 0 && dst.cols > 0
+        && src.rows % dst.rows == 0 && src.cols % dst.cols == 0);
+}
+// every band of dst rows is shrunk from its own band of src rows
+
+static void shrinkRows(const cv::Mat &src, cv::Mat &dst, const cv::Range &rows)
+{
+    if (dst.data == src.data)
+        return;
+    // shared, nothing to shrink
+
+    const int factor = src.rows / dst.rows;
+
+    cv::Mat dstRows = dst.rowRange(rows);
+    cv::Mat srcRows = rows.size() == dst.rows ? src
+        : src.rowRange(rows.start*factor, rows.end*factor);
+
+    cv::resize(srcRows, dstRows, dstRows.size(), 0.0, 0.0, cv::INTER_AREA);
 }
+// rows of dst shrunk from src, area averaging by an integer factor
+// gives bands the same values as shrinking the whole plane
 
 void StructuredEdgeDetection::__getFeatures
-    (const cv::Mat &img, NChannelsMat &features)
+    (const cv::Mat &img, NChannelsMat &features, DetectionWorkspace &workspace)
 {
-    cv::Mat labImg = img;
+    __rgbToLab(img, workspace.lab);
+    __getLabFeatures(workspace.lab, features, workspace);
+}
+
+void StructuredEdgeDetection::__getLabFeatures
+    (const cv::Mat &labImg, NChannelsMat &features, DetectionWorkspace &workspace)
+{
+    __prepareFeatures(labImg, 0, workspace);
+
+    for (int pass = 0; pass < NUMBER_OF_FEATURE_PASSES; ++pass)
+    {
+        WorkUnitsInvoker units;
+        addFeaturePass(*this, pass, workspace, units);
+
+        cv::parallel_for_(cv::Range(0, units.size()), units, __parallelStripes());
+    }
 
-    labImg.convertTo(labImg, cv::DataType<uchar>::type, 255.0);
-    cv::cvtColor(labImg, labImg, CV_RGB2Lab);
-    labImg.convertTo(labImg, cv::DataType<float>::type, 1/255.0);
+    features = workspace.features;
+}
 
+void StructuredEdgeDetection::__prepareFeatures
+    (const cv::Mat &labImg, const DetectionWorkspace *previous, DetectionWorkspace &workspace)
+{
     int shrink  = __rf.options.shrinkNumber;
     int outNum  = __rf.options.numberOfOutputChannels;
     int gradNum = __rf.options.numberOfGradientOrientations;
     int gnrmRad = __rf.options.gradientNormalizationRadius;
+    int pad = __rf.options.patchSize / 2;
 
-    std::vector <cv::Mat> featureArray;
+    workspace.gradients.resize(numberOfGradientScales);
 
-    cv::Size nSize = img.size() / float(shrink);
-    cv::split(__imresize(labImg, nSize), featureArray);
+    cv::Rect shared(pad/2, pad/2, labImg.cols/2, labImg.rows/2);
+    // half of the padded image of this scale is the padded image
+    // of the previous one without half of its padding
 
-    CV_INIT_VECTOR(float, scales, {1.0, 0.5});
+    bool sharing = previous != 0 && (shared & cv::Rect(0, 0, previous->gradients[0].magnitude.cols,
+        previous->gradients[0].magnitude.rows)) == shared;
 
-    for (size_t k = 0; k < scales.size(); ++k)
+    for (int k = 0; k < numberOfGradientScales; ++k)
     {
-        int sizeOfPatch = std::max( 1, int(shrink*scales[k]) );
+        GradientWorkspace &gradient = workspace.gradients[k];
+
+        if (k == 1 && sharing)
+        {
+            gradient.image.release();
+            gradient.magnitude = previous->gradients[0].magnitude(shared);
+            gradient.bins = previous->gradients[0].bins(shared);
+        }
+        else
+        {
+            __imresize(labImg, gradientScales[k]*labImg.size(), gradient.image);
+
+            if (gradient.magnitude.isSubmatrix())
+            {
+                gradient.magnitude.release();
+                gradient.bins.release();
+            }
+            // no longer a part of maps of another pyramid level
+
+            gradient.magnitude.create(gradient.image.size(), CV_32FC1);
+            gradient.bins.create(gradient.image.size(), CV_8UC1);
+
+            if (boxRadius(gnrmRad) == 0)
+                gradient.normalization = gradient.magnitude;
+            else
+            {
+                if (gradient.normalization.data == gradient.magnitude.data)
+                    gradient.normalization.release();
+                gradient.normalization.create(gradient.image.size(), CV_32FC1);
+            }
+        }
 
-        cv::Mat magnitude, histogram;
-        __imhog(/**/ __imresize(labImg, scales[k]*img.size()),
-            magnitude, histogram, gradNum, sizeOfPatch, gnrmRad /**/);
+        int sizeOfPatch = std::max( 1, int(shrink*gradientScales[k]) );
 
-        featureArray.push_back(/**/ __imresize( magnitude, nSize ).clone() /**/);
-        featureArray.push_back(/**/ __imresize( histogram, nSize ).clone() /**/);
+        gradient.histograms.resize(gradNum);
+        for (int b = 0; b < gradNum; ++b)
+            gradient.histograms[b].create(gradient.magnitude.size()/float(sizeOfPatch), CV_32FC1);
     }
 
-    // Mixing and smoothing
+    cv::Size nSize = labImg.size() / float(shrink);
+    shrunkBuffer(labImg, nSize, workspace.shrunk);
+
+    std::vector <cv::Mat> &planes = workspace.planes;
+    planes.resize(3 + numberOfGradientScales*(1 + gradNum));
+    // every plane keeps its buffer between calls
+
+    for (int p = 0; p < 3; ++p)
+        planes[p].create(nSize, CV_32FC1);
+    for (int p = 3; p < int(planes.size()); ++p)
+        shrunkBuffer(planeSource(workspace, p, gradNum), nSize, planes[p]);
+    // planes stay planar until mixChannels
 
     int resType = CV_MAKETYPE(cv::DataType<float>::type, outNum);
-    features.create(nSize, resType);
+    workspace.features.create(nSize, resType);
+
+    prepareBands(workspace, numberOfGradientScales);
+    // passes of all scales of gradients run in one loop
 
-    std::vector <int> fromTo;
+    std::vector <std::vector <cv::Mat> > &bandPlanes = workspace.bandPlanes;
+    if (int(bandPlanes.size()) < workspace.numberOfBands)
+        bandPlanes.resize(workspace.numberOfBands);
+    for (int b = 0; b < workspace.numberOfBands; ++b)
+        bandPlanes[b].resize(planes.size());
+
+    std::vector <int> &fromTo = workspace.fromTo;
+    fromTo.resize(2*outNum);
     for (int i = 0; i < 2*outNum; ++i)
-        fromTo.push_back(i/2);
-    cv::mixChannels(featureArray, features, fromTo);
+        fromTo[i] = i/2;
 }
 
-void StructuredEdgeDetection::__detectEdges
-    (const NChannelsMat &features, cv::Mat &dst)
+int StructuredEdgeDetection::__featurePassRows
+    (const int pass, const int scale, const DetectionWorkspace &workspace)
 {
-    int shrink = __rf.options.shrinkNumber;
-    int rfs = __rf.options.regFeatureSmoothingRadius;
-    int sfs = __rf.options.ssFeatureSmoothingRadius;
+    int gradNum = __rf.options.numberOfGradientOrientations;
+    int gnrmRad = __rf.options.gradientNormalizationRadius;
 
-    int nTreesEval = __rf.options.numberOfTreesToEvaluate;
-    int nTrees = __rf.options.numberOfTrees;
-    int nTreesNodes = __rf.numberOfTreeNodes;
+    const GradientWorkspace &gradient = workspace.gradients[scale];
 
-    const int channels = features.channels();
-    int pSize  = __rf.options.patchSize;
+    switch (pass)
+    {
+    case FEATURE_PASS_GRADIENTS:
+    case FEATURE_PASS_DIVISION:
+        return gradient.image.empty() ? 0 : gradient.magnitude.rows;
+    case FEATURE_PASS_NORMALIZATION:
+        return gradient.image.empty() || boxRadius(gnrmRad) == 0 ? 0 : gradient.magnitude.rows;
+    case FEATURE_PASS_HISTOGRAMS:
+        return gradient.histograms[0].rows;
+    case FEATURE_PASS_MIXING:
+    {
+        if (scale != 0)
+            return 0;
+        // one body mixes planes of all scales
 
-    int nFeatures = pSize*pSize*channels/shrink/shrink;
-    int outNum = __rf.options.numberOfOutputChannels;
+        bool banded = shrinksByRows(workspace.gradients[0].image, workspace.shrunk);
+        for (int p = 3; p < int(workspace.planes.size()); ++p)
+            banded = banded && shrinksByRows(planeSource(workspace, p, gradNum), workspace.planes[p]);
 
-    int stride = __rf.options.stride;
-    int ipSize = __rf.options.patchInnerSize;
-    int gridSize = __rf.options.selfsimilarityGridSize;
+        return banded ? workspace.features.rows : 1;
+        // all rows at once when sizes are not multiples of the one of features
+    }
+    default:
+        CV_Error(CV_StsBadArg, "unknown feature pass");
+    }
 
-    const int height = cvCeil( double(features.rows*shrink - pSize) / stride );
-    const int width  = cvCeil( double(features.cols*shrink - pSize) / stride );
-    // image size in patches with overlapping
+    return 0;
+}
 
-    //-------------------------------------------------------------------------
+void StructuredEdgeDetection::__featurePass
+    (const int pass, const int scale, DetectionWorkspace &workspace, const cv::Range &rows,
+    const int unit)
+{
+    int shrink  = __rf.options.shrinkNumber;
+    int outNum  = __rf.options.numberOfOutputChannels;
+    int gradNum = __rf.options.numberOfGradientOrientations;
+    int gnrmRad = __rf.options.gradientNormalizationRadius;
 
-    NChannelsMat regFeatures = __imsmooth(features, cvRound(rfs / float(shrink)));
-    NChannelsMat  ssFeatures = __imsmooth(features, cvRound(sfs / float(shrink)));
+    GradientWorkspace &gradient = workspace.gradients[scale];
+    std::vector <float> &buffer = workspace.bandBuffers[scale*workspace.numberOfBands + unit];
 
-    NChannelsMat indexes(height, width, CV_MAKETYPE(cv::DataType<int>::type, nTreesEval));
+    if (pass == FEATURE_PASS_GRADIENTS)
+        gradientMagnitudeOrientation(gradient.image, gradient.magnitude, gradient.bins,
+            gradNum, buffer, rows);
+    // gradient of the channel where it is the largest, as in the original paper
+
+    if (pass == FEATURE_PASS_NORMALIZATION)
+        smoothTriangle(gradient.magnitude, gradient.normalization, boxRadius(gnrmRad),
+            buffer, rows);
+
+    if (pass == FEATURE_PASS_DIVISION)
+        for (int i = rows.start; i < rows.end; ++i)
+        {
+            float *magnitudePtr = gradient.magnitude.ptr<float>(i);
+            const float *normalizationPtr = gradient.normalization.ptr<float>(i);
+
+            for (int j = 0; j < gradient.magnitude.cols; ++j)
+                magnitudePtr[j] /= float(normalizationPtr[j] + 0.1);
+        }
+    // in place, normalization can be magnitude itself
+
+    if (pass == FEATURE_PASS_HISTOGRAMS)
+    {
+        int sizeOfPatch = std::max( 1, int(shrink*gradientScales[scale]) );
+
+        orientationHistograms(gradient.magnitude, gradient.bins, gradNum, sizeOfPatch,
+            gradient.histograms[0].size(), gradient.histograms, buffer, rows);
+    }
+
+    if (pass == FEATURE_PASS_MIXING)
+    {
+        NChannelsMat &features = workspace.features;
+        std::vector <cv::Mat> &planes = workspace.planes;
+
+        cv::Range band = __featurePassRows(pass, scale, workspace) == features.rows
+            ? rows : cv::Range(0, features.rows);
+
+        shrinkRows(workspace.gradients[0].image, workspace.shrunk, band);
+
+        cv::Mat shrunkRows = workspace.shrunk.rowRange(band);
+        cv::Mat labRows[3];
+        for (int p = 0; p < 3; ++p)
+            labRows[p] = planes[p].rowRange(band);
+        cv::split(shrunkRows, labRows);
+
+        std::vector <cv::Mat> &planeRows = workspace.bandPlanes[unit];
+        for (int p = 0; p < int(planes.size()); ++p)
+        {
+            if (p >= 3)
+                shrinkRows(planeSource(workspace, p, gradNum), planes[p], band);
+            planeRows[p] = planes[p].rowRange(band);
+        }
+
+        cv::Mat featureRows = features.rowRange(band);
+        cv::mixChannels(&planeRows[0], planeRows.size(), &featureRows, 1,
+            &workspace.fromTo[0], outNum);
+    }
+}
+
+cv::Ptr <CompiledForest> StructuredEdgeDetection::__compileForest
+    (const int featureCols, const int channels)
+{
+    cv::AutoLock lock(__compiledForestsMutex);
+
+    std::map <int, cv::Ptr <CompiledForest> >::iterator
+        it = __compiledForests.find(featureCols);
+    if (it != __compiledForests.end())
+        return it->second;
+
+    if (__compiledForests.size() >= 16)
+        __compiledForests.clear();
+    // keep memory bounded when frame sizes vary a lot
+
+    int shrink = __rf.options.shrinkNumber;
+    int pSize  = __rf.options.patchSize;
+    int gridSize = __rf.options.selfsimilarityGridSize;
+
+    int nFeatures = pSize*pSize*channels/shrink/shrink;
 
     std::vector <int> offsetI(/**/ CV_SQR(pSize/shrink)*channels, 0);
     for (int i = 0; i < CV_SQR(pSize/shrink)*channels; ++i)
@@ -155,20 +519,10 @@ void StructuredEdgeDetection::__detectEdges
         int x = i/channels%(pSize/shrink);
         int y = i/channels/(pSize/shrink);
 
-        offsetI[i] = y*(features.cols/shrink)*channels + x*channels + (i%channels);
+        offsetI[i] = y*(featureCols/shrink)*channels + x*channels + (i%channels);
     }
     // lookup table for mapping linear index to offsets
 
-    //std::vector <int> offsetE(/**/ CV_SQR(ipSize)*outNum, 0);
-    //for (int i = 0; i < CV_SQR(ipSize)*outNum; ++i)
-    //{
-    //    int x = i/outNum%(ipSize);
-    //    int y = i/outNum/(ipSize);
-    //
-    //    offsetE[i] = y*(.../shrink)*outNum + x*outNum + (i%outNum);
-    //}
-    //// lookup table for mapping linear index to offsets
-
     std::vector <int> offsetX( CV_SQR(gridSize)*(CV_SQR(gridSize) - 1)*channels, 0);
     std::vector <int> offsetY( CV_SQR(gridSize)*(CV_SQR(gridSize) - 1)*channels, 0);
     for (int i = 0, n = 0; i < CV_SQR(gridSize)*channels; ++i)
@@ -185,190 +539,1428 @@ void StructuredEdgeDetection::__detectEdges
             int y2 = cvRound(/**/ 2*( (j/gridSize) + 0.5 )*hc /**/);
             // "+ 0.5" means cell center
 
-            offsetX[n] = y1*(features.cols/shrink)*channels + x1*channels + (i%channels);
-            offsetY[n] = y2*(features.cols/shrink)*channels + x2*channels + (i%channels);
+            offsetX[n] = y1*(featureCols/shrink)*channels + x1*channels + (i%channels);
+            offsetY[n] = y2*(featureCols/shrink)*channels + x2*channels + (i%channels);
         }
-        // lookup tables for mapping linear index to offset pairs
+    // lookup tables for mapping linear index to offset pairs
+
+    cv::Ptr <CompiledForest> compiledForest = new CompiledForest(__nodes.size());
+    __compiledForests[featureCols] = compiledForest;
 
-        for (int i = 0; i < height; ++i)
+    CompiledForest &compiled = *compiledForest;
+
+    for (size_t k = 0; k < __nodes.size(); ++k)
+    {
+        const PackedNode &node = __nodes[k];
+
+        compiled[k].child = node.child;
+        compiled[k].threshold = node.threshold;
+
+        if (node.child < 0)
+        {
+            compiled[k].offset1 = node.featureId;
+            compiled[k].offset2 = -1;
+        }
+        else if (node.featureId >= nFeatures)
+        {
+            compiled[k].offset1 = offsetX[node.featureId - nFeatures];
+            compiled[k].offset2 = offsetY[node.featureId - nFeatures];
+        }
+        else
         {
-            float *regFeaturesPtr = regFeatures.ptr<float>(i*stride/shrink);
-            float  *ssFeaturesPtr = ssFeatures.ptr<float>(i*stride/shrink);
+            compiled[k].offset1 = offsetI[node.featureId];
+            compiled[k].offset2 = -1;
+        }
+    }
 
-            int *indexPtr = indexes.ptr<int>(i);
+    return compiledForest;
+}
 
-            for (int j = 0, k = 0; j < width; ++k, j += !(k %= nTreesEval))
-                // for j,k in [0;width)x[0;nTreesEval)
-            {
-                int currentNode = ( ((i + j)%(2*nTreesEval) + k)%nTrees )*nTreesNodes;
-                // select root node of the tree to evaluate
+cv::Ptr <QuickScorerForest> StructuredEdgeDetection::__compileQuickScorer
+    (const int featureCols, const int channels)
+{
+    cv::Ptr <CompiledForest> compiledForest = __compileForest(featureCols, channels);
 
-                int offset = (j*stride/shrink) * channels;
-                while (__rf.childs[currentNode] != 0)
-                {
-                    int currentId = __rf.featureIds[currentNode];
-                    float currentFeature;
+    cv::AutoLock lock(__compiledForestsMutex);
 
-                    if (currentId >= nFeatures)
-                    {
-                        int xIndex = offsetX[currentId - nFeatures];
-                        float A = ssFeaturesPtr[offset + xIndex];
+    std::map <int, cv::Ptr <QuickScorerForest> >::iterator
+        it = __quickScorerForests.find(featureCols);
+    if (it != __quickScorerForests.end())
+        return it->second;
 
-                        int yIndex = offsetY[currentId - nFeatures];
-                        float B = ssFeaturesPtr[offset + yIndex];
+    if (__quickScorerForests.size() >= 16)
+        __quickScorerForests.clear();
 
-                        currentFeature = A - B;
-                    }
-                    else
-                        currentFeature = regFeaturesPtr[offset + offsetI[currentId]];
-
-                    // compare feature to threshold and move left or right accordingly
-                    if (currentFeature < __rf.thresholds[currentNode])
-                        currentNode = __rf.childs[currentNode] - 1;
-                    else
-                        currentNode = __rf.childs[currentNode];
-                }
+    cv::Ptr <QuickScorerForest> quickScorer = new QuickScorerForest;
+    buildQuickScorer(*compiledForest, __rf.options.numberOfTrees,
+        __rf.numberOfTreeNodes, *quickScorer);
+
+    __quickScorerForests[featureCols] = quickScorer;
+    return quickScorer;
+}
+
+class ForestEvaluationInvoker : public cv::ParallelLoopBody
+{
+public:
+    ForestEvaluationInvoker(const RandomForest &_rf, const int _evaluation,
+        const DetectionWorkspace &workspace, NChannelsMat &_indexes)
+        : rf(_rf), nodes(&(*workspace.compiledForest)[0]),
+          quickScorer(workspace.quickScorer.empty() ? 0 : &(*workspace.quickScorer)),
+          evaluation(_evaluation), stride(workspace.stride),
+          nTreesEval(workspace.numberOfTreesToEvaluate), regFeatures(workspace.regFeatures),
+          ssFeatures(workspace.ssFeatures), roots(workspace.roots),
+          offsets(workspace.offsets), indexes(_indexes) {}
+
+    virtual void operator() (const cv::Range &range) const
+    {
+        int shrink = rf.options.shrinkNumber;
+
+        const int width = indexes.cols;
+        const int period = 2*nTreesEval;
 
-                indexPtr[j*nTreesEval + k] = currentNode;
+        for (int i = range.start; i < range.end; ++i)
+        {
+            const float *regFeaturesPtr = regFeatures.ptr<float>(i*stride/shrink);
+            const float  *ssFeaturesPtr = ssFeatures.ptr<float>(i*stride/shrink);
+
+            int *indexPtr = indexes.ptr<int>(i);
+
+            for (int k = 0; k < nTreesEval; ++k)
+            {
+                const int *rootsPtr = &roots[k*(period + width) + i%period];
+                // root nodes of trees to evaluate along the row
+
+                if (quickScorer == 0)
+                    evaluateTrees(nodes, regFeaturesPtr, ssFeaturesPtr, rootsPtr, &offsets[0],
+                        width, indexPtr + k, nTreesEval, evaluation);
+                else
+                    evaluateTreesQuickScorer(nodes, *quickScorer, regFeaturesPtr, ssFeaturesPtr,
+                        rootsPtr, &offsets[0], width, indexPtr + k, nTreesEval);
             }
         }
+    }
+
+private:
+    const RandomForest &rf;
+    const CompiledNode *nodes;
+    const QuickScorerForest *quickScorer;
+    const int evaluation;
+
+    const int stride;
+    const int nTreesEval;
 
-        //dst.create(nSize, CV_MAKETYPE(cv::DataType<float>::type, outNum));
-        //
-        //for (int i = 0; i < height; ++i)
-        //{
-        //    int *indexPtr = indexes.ptr<int>(i);
-        //    float *dstPtr = dst.ptr<float>(i*stride)
-        //
-        //        for (int j = 0, k = 0; j < width; ++k, j += !(k %= nTreesEval))
-        //        {// for j,k in [0;width)x[0;nTreesEval)
-        //
-        //            int currentNode = indexPtr[j*channels + k];
-        //            ;//float *E1 = E + (r*stride) + (c*stride)*h2;
-        //
-        //            int start  = __rf.edgeBoundaries[currentNode];
-        //            int finish = __rf.edgeBoundaries[currentNode + 1];
-        //
-        //            if (start == finish)
-        //                continue;
-        //
-        //            for (int p = start; p < finish; +p)
-        //                ;//E1[eids[eBins[b]]]++;
-        //        }
-        //}
-        //
-        //dst *= 2.0f * CV_SQR(stride) / CV_SQR(ipSize) / nTreesEval;
+    const NChannelsMat &regFeatures;
+    const NChannelsMat &ssFeatures;
+    const std::vector <int> &roots;
+    const std::vector <int> &offsets;
+
+    NChannelsMat &indexes;
+};
+// rows of patches are independent, each range of rows fills its rows of indexes
+
+static int smoothingRadius(const RandomForest &rf, const int rad)
+{
+    return boxRadius(cvRound(rad / float(rf.options.shrinkNumber)));
 }
+// box radius of feature smoothing, rad is in image pixels
 
-void StructuredEdgeDetection::detectSingleScale
-    (cv::InputArray _src, cv::OutputArray _dst)
+static void smoothedBuffer(const NChannelsMat &features, const int radius, NChannelsMat &dst)
 {
-    cv::Mat src = _src.getMat();
-    CV_Assert( src.type() == CV_32FC3 );
+    if (radius == 0)
+        dst = features;
+    else
+    {
+        if (dst.data == features.data)
+            dst.release();
+        dst.create(features.size(), features.type());
+    }
+}
+// dst shares data with features when there is nothing to smooth
+
+void StructuredEdgeDetection::__prepareSmoothing
+    (const NChannelsMat &features, DetectionWorkspace &workspace)
+{
+    int radius1 = smoothingRadius(__rf, __rf.options.regFeatureSmoothingRadius);
+    int radius2 = smoothingRadius(__rf, __rf.options.ssFeatureSmoothingRadius);
+
+    smoothedBuffer(features, radius1, workspace.regFeatures);
+
+    if (radius2 == radius1)
+        workspace.ssFeatures = workspace.regFeatures;
+    else
+        smoothedBuffer(features, radius2, workspace.ssFeatures);
 
-    NChannelsMat features;
-    __getFeatures(src, features);
-    __detectEdges(features, _dst.getMat());
+    prepareBands(workspace, 1);
 }
 
-void StructuredEdgeDetection::detectMultipleScales
-    (cv::InputArray _src, cv::OutputArray _dst)
+void StructuredEdgeDetection::__smoothFeatures
+    (const NChannelsMat &features, DetectionWorkspace &workspace, const cv::Range &rows,
+    const int unit)
 {
-    cv::Mat src = _src.getMat();
-    CV_Assert( src.type() == CV_32FC3 );
+    int radius1 = smoothingRadius(__rf, __rf.options.regFeatureSmoothingRadius);
+    int radius2 = smoothingRadius(__rf, __rf.options.ssFeatureSmoothingRadius);
 
-    int resType = CV_MAKETYPE(cv::DataType<float>::type, __rf.options.numberOfOutputChannels);
-    NChannelsMat result(src.size(), resType, 0);
+    std::vector <float> &buffer = workspace.bandBuffers[unit];
 
-    CV_INIT_VECTOR(float, scales, {0.5f, 1.0f, 2.0f});
-    for (size_t i = 0; i < scales.size(); ++i)
+    NChannelsMat &regFeatures = workspace.regFeatures;
+    NChannelsMat &ssFeatures  = workspace.ssFeatures;
+
+    if (radius1 != 0 && radius2 != 0 && radius1 != radius2)
+        smoothTriangle(features, regFeatures, radius1, ssFeatures, radius2, buffer, rows);
+    else
     {
-        cv::Mat cSource = __imresize(src, scales[i]*src.size());
+        if (radius1 != 0)
+            smoothTriangle(features, regFeatures, radius1, buffer, rows);
+        if (radius2 != 0 && radius2 != radius1)
+            smoothTriangle(features, ssFeatures, radius2, buffer, rows);
+    }
+    // two smoothings in one pass over features, buffers shared
+    // by __prepareSmoothing need nothing
+}
 
-        NChannelsMat cResult(cSource.size(), resType, 0);
-        detectSingleScale(cSource, cResult);
+class FeatureSmoothingInvoker : public cv::ParallelLoopBody
+{
+public:
+    FeatureSmoothingInvoker(StructuredEdgeDetection &_detector, const NChannelsMat &_features,
+        const int _bandRows, DetectionWorkspace &_workspace)
+        : detector(_detector), features(_features), bandRows(_bandRows), workspace(_workspace) {}
 
-        result += __imresize(cResult, result.size());
+    virtual void operator() (const cv::Range &range) const
+    {
+        detector.__smoothFeatures(features, workspace, range, range.start / bandRows);
     }
-    result /= float(scales.size());
 
-    result.copyTo(_dst.getMat());
+private:
+    StructuredEdgeDetection &detector;
+    const NChannelsMat &features;
+    const int bandRows;
+
+    DetectionWorkspace &workspace;
+};
+// band of rows of smoothed features, scratch of the band is kept in workspace
+
+static void addSmoothing(StructuredEdgeDetection &detector, const NChannelsMat &features,
+    DetectionWorkspace &workspace, WorkUnitsInvoker &units)
+{
+    detector.__prepareSmoothing(features, workspace);
+
+    int size = unitRows(features.rows, features.cols*features.channels(),
+        workspace.numberOfBands);
+
+    units.add(new FeatureSmoothingInvoker(detector, features, size, workspace),
+        features.rows, size);
 }
+// units smoothing features into workspace
 
-StructuredEdgeDetection::StructuredEdgeDetection(const std::string &filename)
+void StructuredEdgeDetection::__evaluateForest
+    (const NChannelsMat &features, NChannelsMat &indexes, DetectionWorkspace &workspace)
 {
-    cv::FileStorage modelFile(filename, cv::FileStorage::READ);
+    __prepareForest(features, indexes, workspace);
+
+    ForestEvaluationInvoker invoker(__rf, __forestEvaluation, workspace, indexes);
+    cv::parallel_for_(cv::Range(0, indexes.rows), invoker, __parallelStripes());
+}
 
-    __rf.options.stride = modelFile["options"]["stride"];
-    __rf.options.shrinkNumber = modelFile["options"]["shrinkNumber"];
-    __rf.options.patchSize = modelFile["options"]["patchSize"];
-    __rf.options.patchInnerSize = modelFile["options"]["patchInnerSize"];
+void StructuredEdgeDetection::__prepareForest
+    (const NChannelsMat &features, NChannelsMat &indexes, DetectionWorkspace &workspace)
+{
+    WorkUnitsInvoker smoothing;
+    addSmoothing(*this, features, workspace, smoothing);
 
-    __rf.options.numberOfGradientOrientations = modelFile["options"]["numberOfGradientOrientations"];
-    __rf.options.gradientSmoothingRadius = modelFile["options"]["gradientSmoothingRadius"];
-    __rf.options.regFeatureSmoothingRadius = modelFile["options"]["regFeatureSmoothingRadius"];
-    __rf.options.ssFeatureSmoothingRadius = modelFile["options"]["ssFeatureSmoothingRadius"];
-    __rf.options.gradientNormalizationRadius = modelFile["options"]["gradientNormalizationRadius"];
+    cv::parallel_for_(cv::Range(0, smoothing.size()), smoothing, __parallelStripes());
 
-    __rf.options.selfsimilarityGridSize = modelFile["options"]["selfsimilarityGridSize"];
+    __prepareForestTables(features, indexes, workspace);
+}
 
-    __rf.options.numberOfTrees = modelFile["options"]["numberOfTrees"];
-    __rf.options.numberOfTreesToEvaluate = modelFile["options"]["numberOfTreesToEvaluate"];
+void StructuredEdgeDetection::__prepareForestTables
+    (const NChannelsMat &features, NChannelsMat &indexes, DetectionWorkspace &workspace)
+{
+    int shrink = __rf.options.shrinkNumber;
 
-    __rf.options.numberOfOutputChannels =
-        2*(__rf.options.numberOfGradientOrientations + 1) + 3;
-    //--------------------------------------------
+    int nTreesEval = __numberOfTreesToEvaluate();
+    int nTrees = __rf.options.numberOfTrees;
+    int nTreesNodes = __rf.numberOfTreeNodes;
 
-    cv::FileNode childs = modelFile["childs"];
-    cv::FileNode featureIds = modelFile["featureIds"];
+    const int channels = features.channels();
+    int pSize  = __rf.options.patchSize;
 
-    std::vector <int> currentTree;
+    int stride = __stride();
 
-    for(cv::FileNodeIterator it = childs.begin();
-        it != childs.end(); ++it)
-    {
-        (*it) >> currentTree;
-        std::copy(currentTree.begin(), currentTree.end(),
-            std::back_inserter(__rf.childs));
-    }
+    workspace.stride = stride;
+    workspace.numberOfTreesToEvaluate = nTreesEval;
 
-    for(cv::FileNodeIterator it = featureIds.begin();
-        it != featureIds.end(); ++it)
-    {
-        (*it) >> currentTree;
-        std::copy(currentTree.begin(), currentTree.end(),
-            std::back_inserter(__rf.featureIds));
-    }
+    const int height = cvCeil( double(features.rows*shrink - pSize) / stride );
+    const int width  = cvCeil( double(features.cols*shrink - pSize) / stride );
+    // image size in patches with overlapping
+
+    //-------------------------------------------------------------------------
+
+    indexes.create(std::max(height, 0), std::max(width, 0),
+        CV_MAKETYPE(cv::DataType<int>::type, nTreesEval));
+
+    workspace.compiledForest = __compileForest(features.cols, channels);
+
+    workspace.quickScorer.release();
+    if (__forestEvaluation == FOREST_EVALUATION_QUICKSCORER)
+        workspace.quickScorer = __compileQuickScorer(features.cols, channels);
+    // held by the workspace while the forest is evaluated
+
+    std::vector <int> &offsets = workspace.offsets;
+    offsets.resize(std::max(width, 1));
+    for (int j = 0; j < width; ++j)
+        offsets[j] = (j*stride/shrink) * channels;
 
-    cv::FileNode thresholds = modelFile["thresholds"];
-    std::vector <float> fcurrentTree;
+    const int period = 2*nTreesEval;
 
-    for(cv::FileNodeIterator it = thresholds.begin();
-        it != thresholds.end(); ++it)
+    std::vector <int> &roots = workspace.roots;
+    roots.resize(nTreesEval*(period + std::max(width, 0)));
+    for (int k = 0, n = 0; k < nTreesEval; ++k)
+        for (int t = 0; t < period + width; ++t, ++n)
+            roots[n] = ( (t%period + k)%nTrees )*nTreesNodes;
+    // patch (i, j) uses tree (i + j)%period + k, the row i
+    // starts at i%period of the sequence for k
+}
+
+static const int coarseFactor = 2;
+// coarse grid of __evaluateCoarseToFine takes every coarseFactor-th patch
+
+static const int magnitudeChannel = 3;
+// full scale gradient magnitude (see planeSource)
+
+class CoarseToFineInvoker : public cv::ParallelLoopBody
+{
+public:
+    CoarseToFineInvoker(const RandomForest &_rf, const int _evaluation, const int _pass,
+        const DetectionParameters &parameters, const NChannelsMat &_features,
+        DetectionWorkspace &workspace, NChannelsMat &_indexes)
+        : rf(_rf), nodes(&(*workspace.compiledForest)[0]),
+          quickScorer(workspace.quickScorer.empty() ? 0 : &(*workspace.quickScorer)),
+          evaluation(_evaluation), pass(_pass),
+          edgeThreshold(parameters.coarseEdgeThreshold),
+          gradientThreshold(parameters.coarseGradientThreshold),
+          stride(workspace.stride), nTreesEval(workspace.numberOfTreesToEvaluate),
+          features(_features), regFeatures(workspace.regFeatures),
+          ssFeatures(workspace.ssFeatures), roots(workspace.roots), offsets(workspace.offsets),
+          coarseRoots(workspace.coarseRoots), coarseOffsets(workspace.coarseOffsets),
+          activity(workspace.coarseActivity), weights(workspace.patchWeights),
+          indexes(_indexes) {}
+
+    virtual void operator() (const cv::Range &range) const
     {
-        (*it) >> fcurrentTree;
-        std::copy(fcurrentTree.begin(), fcurrentTree.end(),
-            std::back_inserter(__rf.thresholds));
-    }
+        for (int i = range.start; i < range.end; ++i)
+        {
+            if (pass == 0)
+                evaluateCoarse(i);
 
-    //cv::FileNode edgeBoundaries = modelFile["edgeBoundaries"];
-    //cv::FileNode edgeBins = modelFile["edgeBins"];
-    //
-    //for(cv::FileNodeIterator it = edgeBoundaries.begin();
-    //    it != edgeBoundaries.end(); ++it)
-    //{
-    //    (*it) >> currentTree;
-    //    std::copy(currentTree.begin(), currentTree.end(),
-    //        std::back_inserter(__rf.edgeBoundaries));
-    //}
-    //
-    //for(cv::FileNodeIterator it = edgeBins.begin();
-    //    it != edgeBins.end(); ++it)
-    //{
-    //    (*it) >> currentTree;
-    //    std::copy(currentTree.begin(), currentTree.end(),
-    //        std::back_inserter(__rf.edgeBins));
-    //}
+            if (pass == 1)
+                weighPatches(i);
 
-    __rf.numberOfTreeNodes = int( __rf.childs.size() ) / __rf.options.numberOfTrees;
-}
\ No newline at end of file
+            if (pass == 2)
+                evaluateFine(i);
+        }
+    }
+
+private:
+    void evaluate(const int i, const int *rootsPtr, const int *offsetsPtr, const int count,
+        int *leaves, const int leavesStep) const
+    {
+        int shrink = rf.options.shrinkNumber;
+
+        const float *regFeaturesPtr = regFeatures.ptr<float>(i*stride/shrink);
+        const float  *ssFeaturesPtr = ssFeatures.ptr<float>(i*stride/shrink);
+
+        if (quickScorer == 0)
+            evaluateTrees(nodes, regFeaturesPtr, ssFeaturesPtr, rootsPtr, offsetsPtr,
+                count, leaves, leavesStep, evaluation);
+        else
+            evaluateTreesQuickScorer(nodes, *quickScorer, regFeaturesPtr, ssFeaturesPtr,
+                rootsPtr, offsetsPtr, count, leaves, leavesStep);
+    }
+    // patches of the row i as ForestEvaluationInvoker does it
+
+    void evaluateCoarse(const int ci) const
+    {
+        int shrink = rf.options.shrinkNumber;
+        int pSize  = rf.options.patchSize;
+        int ipSize = rf.options.patchInnerSize;
+        int nBnds  = int(rf.edgeBoundaries.size() - 1) / int(rf.childs.size());
+
+        const int i = ci*coarseFactor;
+        const int period = 2*nTreesEval;
+        const int coarseWidth = activity.cols;
+
+        int *indexPtr = indexes.ptr<int>(i);
+
+        for (int k = 0; k < nTreesEval; ++k)
+            evaluate(i, &coarseRoots[(k*period + i%period)*coarseWidth], &coarseOffsets[0],
+                coarseWidth, indexPtr + k, coarseFactor*nTreesEval);
+
+        const int channels = features.channels();
+        const int border = (pSize - ipSize)/2/shrink;
+        const int extent = ((coarseFactor - 1)*stride + ipSize)/shrink;
+        // inner patches of all patches of the cell, in features
+
+        const float edgeLimit = edgeThreshold*nTreesEval*CV_SQR(ipSize);
+
+        uchar *activityPtr = activity.ptr<uchar>(ci);
+
+        for (int cj = 0; cj < coarseWidth; ++cj)
+        {
+            const int *leaves = indexPtr + cj*coarseFactor*nTreesEval;
+
+            int edgePixels = 0;
+            for (int k = 0; k < nTreesEval; ++k)
+            {
+                int node = leaves[k]*nBnds;
+                edgePixels += rf.edgeBoundaries[node + 1] - rf.edgeBoundaries[node];
+            }
+
+            bool active = edgePixels > edgeLimit;
+
+            const int y0 = i*stride/shrink + border, x0 = cj*coarseFactor*stride/shrink + border;
+            const int y1 = std::min(y0 + extent, features.rows);
+            const int x1 = std::min(x0 + extent, features.cols);
+
+            for (int y = y0; y < y1 && !active; ++y)
+            {
+                const float *magnitudePtr = features.ptr<float>(y) + magnitudeChannel;
+                for (int x = x0; x < x1 && !active; ++x)
+                    active = magnitudePtr[x*channels] > gradientThreshold;
+            }
+            // thin edges the coarse leaves may have missed
+
+            activityPtr[cj] = active;
+        }
+    }
+    // coarse row ci: leaves of every coarseFactor-th patch and whether its cell is active
+
+    void weighPatches(const int ci) const
+    {
+        const int height = indexes.rows, width = indexes.cols;
+        const int coarseHeight = activity.rows, coarseWidth = activity.cols;
+
+        const int rowStart = ci*coarseFactor;
+        const int rowEnd = std::min(rowStart + coarseFactor, height);
+
+        for (int cj = 0; cj < coarseWidth; ++cj)
+        {
+            bool refined = false;
+            for (int y = std::max(ci - 1, 0); y <= std::min(ci + 1, coarseHeight - 1); ++y)
+                for (int x = std::max(cj - 1, 0); x <= std::min(cj + 1, coarseWidth - 1); ++x)
+                    refined = refined || activity.at<uchar>(y, x) != 0;
+            // neighbourhood of active cells is evaluated at all patches
+
+            const int colStart = cj*coarseFactor;
+            const int colEnd = std::min(colStart + coarseFactor, width);
+
+            for (int y = rowStart; y < rowEnd; ++y)
+                for (int x = colStart; x < colEnd; ++x)
+                    weights.at<uchar>(y, x) = uchar(refined);
+
+            if (!refined)
+                weights.at<uchar>(rowStart, colStart) =
+                    uchar((rowEnd - rowStart)*(colEnd - colStart));
+            // the coarse patch votes for all patches of its cell, so every pixel
+            // gets as many votes as with dense evaluation
+        }
+    }
+
+    bool pending(const uchar *weightPtr, const bool coarseRow, const int j) const
+    {
+        return weightPtr[j] == 1 && !(coarseRow && j%coarseFactor == 0);
+    }
+    // patch of a refined cell not evaluated on the coarse grid
+
+    void evaluateFine(const int i) const
+    {
+        const int width = indexes.cols;
+        const int period = 2*nTreesEval;
+        const bool coarseRow = i%coarseFactor == 0;
+
+        const uchar *weightPtr = weights.ptr<uchar>(i);
+        int *indexPtr = indexes.ptr<int>(i);
+
+        for (int j = 0; j < width; )
+        {
+            if (!pending(weightPtr, coarseRow, j))
+            {
+                ++j;
+                continue;
+            }
+
+            int last = j + 1;
+            while (last < width && pending(weightPtr, coarseRow, last))
+                ++last;
+
+            for (int k = 0; k < nTreesEval; ++k)
+                evaluate(i, &roots[k*(period + width) + i%period] + j, &offsets[j],
+                    last - j, indexPtr + j*nTreesEval + k, nTreesEval);
+            // run of pending patches at once
+
+            j = last;
+        }
+    }
+
+    const RandomForest &rf;
+    const CompiledNode *nodes;
+    const QuickScorerForest *quickScorer;
+    const int evaluation;
+    const int pass;
+
+    const float edgeThreshold;
+    const float gradientThreshold;
+
+    const int stride;
+    const int nTreesEval;
+
+    const NChannelsMat &features;
+    const NChannelsMat &regFeatures;
+    const NChannelsMat &ssFeatures;
+    const std::vector <int> &roots;
+    const std::vector <int> &offsets;
+    const std::vector <int> &coarseRoots;
+    const std::vector <int> &coarseOffsets;
+
+    cv::Mat &activity;
+    cv::Mat &weights;
+    NChannelsMat &indexes;
+};
+// passes of __evaluateCoarseToFine: coarse rows with activity of their cells,
+// coarse rows of patch weights, then rows of patches left to evaluate
+
+void StructuredEdgeDetection::__evaluateCoarseToFine
+    (const NChannelsMat &features, NChannelsMat &indexes, DetectionWorkspace &workspace)
+{
+    __prepareForest(features, indexes, workspace);
+    __prepareCoarseToFine(indexes, workspace);
+
+    const int coarseHeight = workspace.coarseActivity.rows;
+
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        CoarseToFineInvoker invoker(__rf, __forestEvaluation, pass, __parameters,
+            features, workspace, indexes);
+        cv::parallel_for_(cv::Range(0, pass < 2 ? coarseHeight : indexes.rows),
+            invoker, __parallelStripes());
+    }
+    // weights of a cell need activity of cells around it
+}
+
+void StructuredEdgeDetection::__prepareCoarseToFine
+    (const NChannelsMat &indexes, DetectionWorkspace &workspace)
+{
+    const int nTreesEval = workspace.numberOfTreesToEvaluate;
+    const int period = 2*nTreesEval;
+
+    const int width = indexes.cols;
+    const int coarseHeight = (indexes.rows + coarseFactor - 1) / coarseFactor;
+    const int coarseWidth  = (indexes.cols + coarseFactor - 1) / coarseFactor;
+
+    std::vector <int> &coarseOffsets = workspace.coarseOffsets;
+    coarseOffsets.resize(std::max(coarseWidth, 1));
+    for (int j = 0; j < coarseWidth; ++j)
+        coarseOffsets[j] = workspace.offsets[j*coarseFactor];
+
+    std::vector <int> &coarseRoots = workspace.coarseRoots;
+    coarseRoots.resize(std::max(nTreesEval*period*coarseWidth, 1));
+    for (int k = 0, n = 0; k < nTreesEval; ++k)
+        for (int p = 0; p < period; ++p)
+            for (int j = 0; j < coarseWidth; ++j, ++n)
+                coarseRoots[n] = workspace.roots[k*(period + width) + p + j*coarseFactor];
+    // every coarseFactor-th root of the sequence for k, per phase i%period of rows,
+    // so coarse patches get the same trees as with dense evaluation
+
+    workspace.coarseActivity.create(coarseHeight, coarseWidth, CV_8UC1);
+    workspace.patchWeights.create(indexes.rows, indexes.cols, CV_8UC1);
+}
+
+class EdgeAggregationInvoker : public cv::ParallelLoopBody
+{
+public:
+    EdgeAggregationInvoker(const RandomForest &_rf, DetectionWorkspace &workspace,
+        const bool weighted = false)
+        : rf(_rf), stride(workspace.stride), nTreesEval(workspace.numberOfTreesToEvaluate),
+          indexes(workspace.indexes), weights(weighted ? &workspace.patchWeights : 0),
+          bandBounds(workspace.bandBounds), offsetE(workspace.edgeOffsets),
+          accumulators(workspace.accumulators) {}
+
+    virtual void operator() (const cv::Range &range) const
+    {
+        int nBnds = int(rf.edgeBoundaries.size() - 1) / int(rf.childs.size());
+
+        const int width = indexes.cols;
+
+        for (int b = range.start; b < range.end; ++b)
+        {
+            const int start = bandBounds[b], finish = bandBounds[b + 1];
+
+            cv::Mat &acc = accumulators[b];
+            acc.setTo(0);
+
+            for (int i = start; i < finish; ++i)
+            {
+                const int *indexPtr = indexes.ptr<int>(i);
+                const uchar *weightPtr = weights == 0 ? 0 : weights->ptr<uchar>(i);
+                float *accPtr = acc.ptr<float>((i - start)*stride);
+
+                for (int j = 0; j < width; ++j, indexPtr += nTreesEval)
+                {
+                    float weight = 1.0f;
+                    if (weightPtr != 0)
+                    {
+                        if (weightPtr[j] == 0)
+                            continue;
+                        weight = weightPtr[j];
+                    }
+                    // patches left out by __evaluateCoarseToFine have no leaves
+
+                    float *patchPtr = accPtr + j*stride;
+
+                    for (int k = 0; k < nTreesEval; ++k)
+                    {
+                        int node = indexPtr[k]*nBnds;
+
+                        int first = rf.edgeBoundaries[node];
+                        int last  = rf.edgeBoundaries[node + 1];
+
+                        for (int p = first; p < last; ++p)
+                            patchPtr[ offsetE[rf.edgeBins[p]] ] += weight;
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    const RandomForest &rf;
+
+    const int stride;
+    const int nTreesEval;
+
+    const NChannelsMat &indexes;
+    const cv::Mat *weights;
+    const std::vector <int> &bandBounds;
+    const std::vector <int> &offsetE;
+
+    std::vector <cv::Mat> &accumulators;
+};
+// every band of patch rows votes into its own accumulator,
+// overlapping inner patches of neighbouring bands never share memory
+
+class EdgeMergeInvoker : public cv::ParallelLoopBody
+{
+public:
+    EdgeMergeInvoker(const std::vector <int> &_bandBounds,
+        const std::vector <cv::Mat> &_accumulators, const int _stride,
+        const int _origin, const float _scale, cv::Mat &_dst)
+        : bandBounds(_bandBounds), accumulators(_accumulators), stride(_stride),
+          origin(_origin), scale(_scale), dst(_dst) {}
+
+    virtual void operator() (const cv::Range &range) const
+    {
+        const int accCols = accumulators[0].cols;
+
+        for (int y = range.start; y < range.end; ++y)
+        {
+            float *dstPtr = dst.ptr<float>(y);
+            float *sumPtr = dstPtr + origin;
+
+            std::fill(dstPtr, dstPtr + dst.cols, 0.0f);
+
+            const int patchRow = y - origin;
+
+            int last = patchRow < 0 ? 0 : int(std::upper_bound(bandBounds.begin(),
+                bandBounds.end() - 1, patchRow / stride) - bandBounds.begin());
+            // bands before last start at or above y
+
+            int first = last;
+            while (first > 0 && patchRow - bandBounds[first - 1]*stride < accumulators[first - 1].rows)
+                --first;
+            // ends of bands grow with their starts, so [first, last) cover y,
+            // at most two unless bands are very thin
+
+            for (int b = first; b < last; ++b)
+            {
+                const float *accPtr = accumulators[b].ptr<float>(patchRow - bandBounds[b]*stride);
+                for (int x = 0; x < accCols; ++x)
+                    sumPtr[x] += accPtr[x];
+            }
+
+            if (first < last)
+                for (int x = 0; x < accCols; ++x)
+                    sumPtr[x] *= scale;
+        }
+    }
+
+private:
+    const std::vector <int> &bandBounds;
+    const std::vector <cv::Mat> &accumulators;
+
+    const int stride;
+    const int origin;
+    const float scale;
+
+    cv::Mat &dst;
+};
+// sum of band accumulators with normalization applied on the way out
+
+static void prepareAggregation(const RandomForest &rf, const int nBands,
+    DetectionWorkspace &workspace)
+{
+    int stride = workspace.stride;
+    int ipSize = rf.options.patchInnerSize;
+
+    const NChannelsMat &indexes = workspace.indexes;
+
+    std::vector <int> &bandBounds = workspace.bandBounds;
+    bandBounds.resize(nBands + 1);
+    for (int b = 0; b <= nBands; ++b)
+        bandBounds[b] = b*indexes.rows / nBands;
+    // contiguous bands of patch rows, one accumulator each
+
+    std::vector <cv::Mat> &accumulators = workspace.accumulators;
+    accumulators.resize(nBands);
+    for (int b = 0; b < nBands; ++b)
+        accumulators[b].create((bandBounds[b + 1] - bandBounds[b] - 1)*stride + ipSize,
+            (indexes.cols - 1)*stride + ipSize, cv::DataType<float>::type);
+
+    std::vector <int> &offsetE = workspace.edgeOffsets;
+    offsetE.resize(CV_SQR(ipSize));
+    for (int k = 0; k < CV_SQR(ipSize); ++k)
+        offsetE[k] = (k/ipSize)*int(accumulators[0].step1()) + k%ipSize;
+    // edge bin --> offset from the inner patch origin, accumulators have the same width
+}
+// band accumulators for workspace.indexes
+
+static const int aggregationBandsPerThread = 2;
+// every band adds an accumulator with the overlap of inner patches, so fewer
+// bands than for feature passes, still enough for threads to balance
+
+static int aggregationBands(const NChannelsMat &indexes)
+{
+    return std::max(1, std::min(aggregationBandsPerThread*cv::getNumThreads(), indexes.rows));
+}
+
+static float edgeScale(const RandomForest &rf, const DetectionWorkspace &workspace)
+{
+    int stride = workspace.stride;
+    int ipSize = rf.options.patchInnerSize;
+    int nTreesEval = workspace.numberOfTreesToEvaluate;
+
+    return 2.0f * CV_SQR(stride) / CV_SQR(ipSize) / nTreesEval;
+}
+// normalization of votes of the forest prepared in workspace
+
+static const int patchesPerUnit = 4096;
+// work unit of forest evaluation and merge, in patches
+
+static void prepareDetection(StructuredEdgeDetection &detector, DetectionWorkspace &workspace,
+    const bool coarseToFine)
+{
+    int shrink = detector.__rf.options.shrinkNumber;
+
+    const NChannelsMat &indexes = workspace.indexes;
+
+    workspace.edges.create(workspace.features.size()*float(shrink), cv::DataType<float>::type);
+    if (indexes.empty())
+    {
+        workspace.edges.setTo(0);
+        return;
+    }
+
+    if (coarseToFine)
+        detector.__prepareCoarseToFine(workspace.indexes, workspace);
+
+    prepareAggregation(detector.__rf, aggregationBands(indexes), workspace);
+}
+// buffers of addDetectionPhase for workspace after __prepareForestTables
+
+static int detectionPhases(const bool coarseToFine)
+{
+    return coarseToFine ? 5 : 3;
+}
+// passes of forest evaluation, aggregation and merge
+
+static void addDetectionPhase(StructuredEdgeDetection &detector, const int phase,
+    const bool coarseToFine, DetectionWorkspace &workspace, WorkUnitsInvoker &units)
+{
+    const RandomForest &rf = detector.__rf;
+    int pSize  = rf.options.patchSize;
+    int ipSize = rf.options.patchInnerSize;
+
+    NChannelsMat &indexes = workspace.indexes;
+    if (indexes.empty())
+        return;
+
+    const int rowsPerUnit = std::max(1, patchesPerUnit / indexes.cols);
+    const int evaluationPhases = detectionPhases(coarseToFine) - 2;
+
+    if (phase < evaluationPhases && coarseToFine)
+        units.add(new CoarseToFineInvoker(rf, detector.__forestEvaluation, phase,
+            detector.__parameters, workspace.features, workspace, indexes),
+            phase < 2 ? workspace.coarseActivity.rows : indexes.rows, rowsPerUnit);
+    else if (phase < evaluationPhases)
+        units.add(new ForestEvaluationInvoker(rf, detector.__forestEvaluation,
+            workspace, indexes), indexes.rows, rowsPerUnit);
+
+    if (phase == evaluationPhases)
+        units.add(new EdgeAggregationInvoker(rf, workspace, coarseToFine),
+            int(workspace.accumulators.size()), 1);
+
+    if (phase == evaluationPhases + 1)
+        units.add(new EdgeMergeInvoker(workspace.bandBounds, workspace.accumulators,
+            workspace.stride, (pSize - ipSize)/2, edgeScale(rf, workspace), workspace.edges),
+            workspace.edges.rows, std::max(1, patchesPerUnit / workspace.edges.cols));
+}
+// units of one phase of __detectEdges for workspace.features after prepareDetection,
+// phases of several images or scales can share a cv::parallel_for_
+
+void StructuredEdgeDetection::__detectEdges
+    (const NChannelsMat &features, cv::Mat &dst, DetectionWorkspace &workspace)
+{
+    CV_Assert( !__rf.edgeBoundaries.empty() );
+
+    int shrink = __rf.options.shrinkNumber;
+    int pSize  = __rf.options.patchSize;
+    int ipSize = __rf.options.patchInnerSize;
+
+    NChannelsMat &indexes = workspace.indexes;
+    if (__parameters.coarseToFine)
+        __evaluateCoarseToFine(features, indexes, workspace);
+    else
+        __evaluateForest(features, indexes, workspace);
+
+    int stride = workspace.stride;
+
+    dst.create(features.size()*float(shrink), cv::DataType<float>::type);
+    if (indexes.empty())
+    {
+        dst.setTo(0);
+        return;
+    }
+
+    int nBands = aggregationBands(indexes);
+    prepareAggregation(__rf, nBands, workspace);
+
+    EdgeAggregationInvoker aggregation(__rf, workspace, __parameters.coarseToFine);
+    cv::parallel_for_(cv::Range(0, nBands), aggregation, nBands);
+
+    EdgeMergeInvoker merge(workspace.bandBounds, workspace.accumulators, stride,
+        (pSize - ipSize)/2, edgeScale(__rf, workspace), dst);
+    // inner patch of the patch at (0, 0) starts at (pSize - ipSize)/2
+
+    cv::parallel_for_(cv::Range(0, dst.rows), merge, __parallelStripes());
+}
+
+cv::Size StructuredEdgeDetection::__paddedSize(const cv::Size &size)
+{
+    int shrink = __rf.options.shrinkNumber;
+    int pad = __rf.options.patchSize / 2;
+
+    return cv::Size(/**/ size.width  + 2*pad + (shrink - (size.width  + 2*pad) % shrink) % shrink,
+                         size.height + 2*pad + (shrink - (size.height + 2*pad) % shrink) % shrink /**/);
+}
+
+static int boxSupport(const int rad)
+{
+    return 2*boxRadius(rad);
+}
+// half-width of the support of smoothing with radius rad (see boxRadius)
+
+int StructuredEdgeDetection::__tileHalo()
+{
+    int shrink = __rf.options.shrinkNumber;
+    int pSize  = __rf.options.patchSize;
+
+    int rfs = __rf.options.regFeatureSmoothingRadius;
+    int sfs = __rf.options.ssFeatureSmoothingRadius;
+    int gnrmRad = __rf.options.gradientNormalizationRadius;
+
+    int smoothHalo = shrink * std::max( boxSupport(cvRound(rfs / float(shrink))),
+                                        boxSupport(cvRound(sfs / float(shrink))) );
+    // smoothing of features, in pixels
+
+    int hogHalo = 2*(boxSupport(gnrmRad) + 1) + 2*shrink;
+    // Sobel and normalization of magnitude at half scale, then shrinking
+
+    int coarseHalo = __parameters.coarseToFine ? 2*coarseFactor*__stride() : 0;
+    // weights of a cell depend on activity of the cells around it and of their patches
+
+    return pSize + smoothHalo + hogHalo + coarseHalo;
+}
+
+void StructuredEdgeDetection::__getPaddedLabFeatures
+    (const cv::Mat &labImg, NChannelsMat &features, DetectionWorkspace &workspace)
+{
+    __pad(labImg, workspace.padded);
+    // color conversion is per pixel, so padding of Lab is padding of source
+
+    __getLabFeatures(workspace.padded, features, workspace);
+}
+
+void StructuredEdgeDetection::__pad(const cv::Mat &img, cv::Mat &imPad)
+{
+    int pad = __rf.options.patchSize / 2;
+    cv::Size padded = __paddedSize(img.size());
+
+    cv::copyMakeBorder(img, imPad, pad, padded.height - img.rows - pad,
+        pad, padded.width - img.cols - pad, cv::BORDER_REFLECT);
+    // patches centered at every stride-th pixel of the image,
+    // padded size divisible by shrink
+}
+
+void StructuredEdgeDetection::__detectLab
+    (const cv::Mat &labImg, cv::OutputArray dst, DetectionWorkspace &workspace,
+    const bool transposed)
+{
+    int pad = __rf.options.patchSize / 2;
+
+    NChannelsMat &features = workspace.features;
+    __getPaddedLabFeatures(labImg, features, workspace);
+
+    cv::Mat &edges = workspace.edges;
+    __detectEdges(features, edges, workspace);
+
+    cv::Mat result = edges(cv::Rect(pad, pad, labImg.cols, labImg.rows));
+
+    if (transposed)
+        cv::transpose(result, dst);
+    else
+        result.copyTo(dst);
+}
+
+void StructuredEdgeDetection::detectSingleScale
+    (cv::InputArray src, cv::OutputArray dst)
+{
+    detectSingleScale(src, dst, __workspaces[0]);
+}
+
+void StructuredEdgeDetection::detectSingleScale
+    (cv::InputArray _src, cv::OutputArray _dst, DetectionWorkspace &workspace)
+{
+    ThreadLimit threadLimit(__numberOfThreads);
+
+    cv::Mat src = _src.getMat();
+    CV_Assert( src.type() == CV_32FC3 );
+
+    __rgbToLab(src, workspace.lab);
+    __detectLab(workspace.lab, _dst, workspace);
+}
+
+void StructuredEdgeDetection::detectSingleScaleTransposed
+    (const std::vector <cv::Mat> &planes, const double scale, cv::OutputArray dst)
+{
+    detectSingleScaleTransposed(planes, scale, dst, __workspaces[0]);
+}
+
+void StructuredEdgeDetection::detectSingleScaleTransposed
+    (const std::vector <cv::Mat> &planes, const double scale, cv::OutputArray dst,
+    DetectionWorkspace &workspace)
+{
+    ThreadLimit threadLimit(__numberOfThreads);
+
+    __transposedPlanesToLab(planes, scale, workspace.lab);
+    __detectLab(workspace.lab, dst, workspace, true);
+}
+
+void StructuredEdgeDetection::getFeaturesTransposed
+    (const std::vector <cv::Mat> &planes, const double scale, NChannelsMat &features)
+{
+    getFeaturesTransposed(planes, scale, features, __workspaces[0]);
+}
+
+void StructuredEdgeDetection::getFeaturesTransposed
+    (const std::vector <cv::Mat> &planes, const double scale, NChannelsMat &features,
+    DetectionWorkspace &workspace)
+{
+    ThreadLimit threadLimit(__numberOfThreads);
+
+    __transposedPlanesToLab(planes, scale, workspace.lab);
+    __getLabFeatures(workspace.lab, features, workspace);
+}
+
+void StructuredEdgeDetection::detectBatch
+    (const std::vector <cv::Mat> &src, std::vector <cv::Mat> &dst)
+{
+    ThreadLimit threadLimit(__numberOfThreads);
+
+    CV_Assert( !__rf.edgeBoundaries.empty() );
+
+    int pad = __rf.options.patchSize / 2;
+
+    const bool coarseToFine = __parameters.coarseToFine;
+
+    dst.resize(src.size());
+
+    for (int step = 0; step <= int(src.size()); ++step)
+    {
+        DetectionWorkspace *next = step < int(src.size()) ? &__workspaces[step % 2] : 0;
+        DetectionWorkspace *current = step > 0 ? &__workspaces[(step - 1) % 2] : 0;
+        // features of workspaces are the queue between the stages, one image in flight
+
+        WorkUnitsInvoker first;
+
+        if (next != 0)
+        {
+            CV_Assert( src[step].type() == CV_32FC3 );
+
+            next->lab.create(src[step].size(), CV_32FC3);
+            first.add(new LabConversionInvoker(src[step], next->lab),
+                src[step].rows, unitRows(src[step].rows, 3*src[step].cols));
+        }
+
+        if (current != 0)
+            addSmoothing(*this, current->features, *current, first);
+
+        cv::parallel_for_(cv::Range(0, first.size()), first, __parallelStripes());
+
+        if (next != 0)
+        {
+            __pad(next->lab, next->padded);
+            __prepareFeatures(next->padded, 0, *next);
+        }
+
+        if (current != 0)
+        {
+            __prepareForestTables(current->features, current->indexes, *current);
+            prepareDetection(*this, *current, coarseToFine);
+        }
+
+        for (int phase = 0; phase < std::max(int(NUMBER_OF_FEATURE_PASSES),
+            detectionPhases(coarseToFine)); ++phase)
+        {
+            WorkUnitsInvoker units;
+
+            if (next != 0 && phase < NUMBER_OF_FEATURE_PASSES)
+                addFeaturePass(*this, phase, *next, units);
+            if (current != 0 && phase < detectionPhases(coarseToFine))
+                addDetectionPhase(*this, phase, coarseToFine, *current, units);
+
+            cv::parallel_for_(cv::Range(0, units.size()), units, __parallelStripes());
+        }
+        // row bands of feature passes of the next image and of detection
+        // of the current one share every parallel loop
+
+        if (current != 0)
+        {
+            const cv::Mat &image = src[step - 1];
+            current->edges(cv::Rect(pad, pad, image.cols, image.rows)).copyTo(dst[step - 1]);
+        }
+    }
+}
+
+void StructuredEdgeDetection::__detectTile
+    (const cv::Mat &src, const cv::Rect &roi, cv::Mat &dst, DetectionWorkspace &workspace)
+{
+    int shrink = __rf.options.shrinkNumber;
+    int stride = __stride();
+    int pad = __rf.options.patchSize / 2;
+
+    cv::Size padded = __paddedSize(src.size());
+
+    int period = 2*__numberOfTreesToEvaluate()*stride;
+    // patch (i, j) uses trees from (i + j)%(2*nTreesEval) (see __prepareForest)
+
+    int align = period;
+    while (align % (2*shrink) != 0)
+        align += period;
+    // lcm(2*nTreesEval*stride, 2*shrink): tile grids of patches, features
+    // and half-scale gradients coincide with the ones of the whole image,
+    // and patches of the tile pick the same trees as there, 2*nTreesEval
+    // is a multiple of coarseFactor, so coarse grids coincide as well
+
+    int halo = __tileHalo();
+
+    cv::Rect tile = roi + cv::Point(pad, pad);
+    // output of the tile in padded image coordinates
+
+    int x0 = std::max(0, (tile.x - halo) / align * align);
+    int y0 = std::max(0, (tile.y - halo) / align * align);
+
+    int x1 = std::min(padded.width,  (tile.br().x + halo + align - 1) / align * align);
+    int y1 = std::min(padded.height, (tile.br().y + halo + align - 1) / align * align);
+    // input of the tile in padded image coordinates
+
+    cv::Rect srcRoi = cv::Rect(x0 - pad, y0 - pad, x1 - x0, y1 - y0)
+        & cv::Rect(0, 0, src.cols, src.rows);
+
+    cv::Mat &imPad = workspace.padded;
+    cv::copyMakeBorder(src(srcRoi), imPad,
+        srcRoi.y - (y0 - pad), (y1 - pad) - srcRoi.br().y,
+        srcRoi.x - (x0 - pad), (x1 - pad) - srcRoi.br().x, cv::BORDER_REFLECT);
+    // the part of the padded image detectSingleScale would use,
+    // border only where the tile touches the image one
+
+    NChannelsMat &features = workspace.features;
+    __getFeatures(imPad, features, workspace);
+
+    cv::Mat &edges = workspace.edges;
+    __detectEdges(features, edges, workspace);
+
+    cv::Mat dstTile = dst(roi);
+    edges(tile - cv::Point(x0, y0)).copyTo(dstTile);
+}
+
+void StructuredEdgeDetection::detectSingleScaleTiled
+    (cv::InputArray _src, cv::OutputArray _dst, const int tileSize)
+{
+    ThreadLimit threadLimit(__numberOfThreads);
+
+    cv::Mat src = _src.getMat();
+    CV_Assert( src.type() == CV_32FC3 );
+    CV_Assert( tileSize > 0 );
+
+    _dst.create(src.size(), cv::DataType<float>::type);
+    cv::Mat dst = _dst.getMat();
+
+    for (int y = 0; y < src.rows; y += tileSize)
+        for (int x = 0; x < src.cols; x += tileSize)
+            __detectTile(src, cv::Rect(x, y, std::min(tileSize, src.cols - x),
+                std::min(tileSize, src.rows - y)), dst, __workspaces[0]);
+}
+
+static const double gradientLambda = 0.11;
+// power law exponent of gradient magnitude and histogram channels,
+// estimate of Dollar et al. for normalized gradients, color channels have 0
+
+void StructuredEdgeDetection::__resampleFeatures
+    (const NChannelsMat &features, const cv::Size &size, const cv::Size &sizeDst,
+    NChannelsMat &dst, const cv::Range &rows)
+{
+    int shrink = __rf.options.shrinkNumber;
+    int pad = __rf.options.patchSize / 2;
+
+    cv::Size featureSize = __paddedSize(sizeDst) / float(shrink);
+
+    cv::Range range = rows;
+    if (rows == cv::Range::all())
+    {
+        dst.create(featureSize, features.type());
+        range = cv::Range(0, dst.rows);
+    }
+    CV_Assert( dst.size() == featureSize && dst.type() == features.type() );
+
+    const double kx = double(size.width) / sizeDst.width;
+    const double ky = double(size.height) / sizeDst.height;
+    const double c = shrink/2.0 - pad;
+
+    cv::Mat transform(2, 3, CV_64FC1, cv::Scalar(0));
+    transform.at<double>(0, 0) = kx;
+    transform.at<double>(0, 2) = c*(kx - 1) / shrink;
+    transform.at<double>(1, 1) = ky;
+    transform.at<double>(1, 2) = c*(ky - 1) / shrink + ky*range.start;
+    // feature pixel u covers image pixels from u*shrink - pad, centers of images
+    // resized relatively to each other are matched, padding stays pad pixels,
+    // the band of dst starts at range.start
+
+    cv::Mat dstRows = dst.rowRange(range);
+    cv::warpAffine(features, dstRows, transform, dstRows.size(),
+        cv::INTER_LINEAR | cv::WARP_INVERSE_MAP, cv::BORDER_REFLECT);
+
+    const float factor = float(std::pow(std::sqrt(kx*ky), gradientLambda));
+    const int channels = dst.channels();
+
+    for (int i = 0; i < dstRows.rows; ++i)
+    {
+        float *dstPtr = dstRows.ptr<float>(i);
+
+        for (int j = 0; j < dstRows.cols; ++j, dstPtr += channels)
+            for (int k = 3; k < channels; ++k)
+                dstPtr[k] *= factor;
+    }
+    // all but three Lab channels are gradient ones (see planeSource)
+}
+
+class FeatureResamplingInvoker : public cv::ParallelLoopBody
+{
+public:
+    FeatureResamplingInvoker(StructuredEdgeDetection &_detector, const NChannelsMat &_features,
+        const cv::Size &_size, const cv::Size &_sizeDst, NChannelsMat &_dst)
+        : detector(_detector), features(_features), size(_size), sizeDst(_sizeDst), dst(_dst) {}
+
+    virtual void operator() (const cv::Range &range) const
+    {
+        detector.__resampleFeatures(features, size, sizeDst, dst, range);
+    }
+
+private:
+    StructuredEdgeDetection &detector;
+    const NChannelsMat &features;
+
+    const cv::Size size;
+    const cv::Size sizeDst;
+
+    NChannelsMat &dst;
+};
+// band of rows of resampled features
+
+static float nearestOctave(const float scale)
+{
+    return float(std::pow(2.0, cvRound(std::log(scale) / std::log(2.0))));
+}
+
+class ScaleAverageInvoker : public cv::ParallelLoopBody
+{
+public:
+    ScaleAverageInvoker(const std::vector <DetectionWorkspace *> &_detection, cv::Mat &_dst)
+        : detection(_detection), dst(_dst) {}
+
+    virtual void operator() (const cv::Range &range) const
+    {
+        for (int y = range.start; y < range.end; ++y)
+        {
+            float *dstPtr = dst.ptr<float>(y);
+            std::fill(dstPtr, dstPtr + dst.cols, 0.0f);
+
+            for (size_t i = 0; i < detection.size(); ++i)
+            {
+                const float *edgesPtr = detection[i]->resized.ptr<float>(y);
+                for (int x = 0; x < dst.cols; ++x)
+                    dstPtr[x] += edgesPtr[x];
+            }
+
+            for (int x = 0; x < dst.cols; ++x)
+                dstPtr[x] /= float(detection.size());
+        }
+    }
+
+private:
+    const std::vector <DetectionWorkspace *> &detection;
+    cv::Mat &dst;
+};
+// edges of all scales resampled to the source size averaged
+
+void StructuredEdgeDetection::detectMultipleScales
+    (cv::InputArray _src, cv::OutputArray _dst)
+{
+    ThreadLimit threadLimit(__numberOfThreads);
+
+    cv::Mat src = _src.getMat();
+    CV_Assert( src.type() == CV_32FC3 );
+
+    int shrink = __rf.options.shrinkNumber;
+    int pad = __rf.options.patchSize / 2;
+
+    CV_Assert( !__rf.edgeBoundaries.empty() );
+
+    const std::vector <float> &scales = __parameters.scales;
+    const bool fastPyramid = __parameters.fastPyramid;
+
+    cv::Mat &lab = __workspaces[0].lab;
+    __rgbToLab(src, lab);
+    // one color conversion, the pyramid is built from Lab
+
+    std::vector <float> exact;
+    for (size_t i = 0; i < scales.size(); ++i)
+        exact.push_back(fastPyramid ? nearestOctave(scales[i]) : scales[i]);
+
+    std::sort(exact.begin(), exact.end());
+    exact.erase(std::unique(exact.begin(), exact.end()), exact.end());
+    // scales with features computed exactly, ascending
+
+    const int nScales = int(scales.size());
+    __scaleWorkspaces.resize(exact.size() + nScales);
+
+    std::vector <int> reference(nScales);
+    std::vector <DetectionWorkspace *> detection(nScales);
+
+    for (int i = 0; i < nScales; ++i)
+    {
+        reference[i] = int(std::lower_bound(exact.begin(), exact.end(),
+            fastPyramid ? nearestOctave(scales[i]) : scales[i]) - exact.begin());
+
+        detection[i] = scales[i] == exact[reference[i]]
+            ? &__scaleWorkspaces[reference[i]] : &__scaleWorkspaces[exact.size() + i];
+    }
+    // workspaces edges of every scale are detected in
+
+    for (size_t i = 0; i < exact.size(); ++i)
+    {
+        DetectionWorkspace &workspace = __scaleWorkspaces[i];
+
+        __imresize(lab, exact[i]*lab.size(), workspace.lab);
+        __pad(workspace.lab, workspace.padded);
+
+        __prepareFeatures(workspace.padded, i > 0 && exact[i] == 2*exact[i - 1]
+            ? &__scaleWorkspaces[i - 1] : 0, workspace);
+    }
+    // cv::resize is parallel itself, gradients at half scale are full scale
+    // ones of the previous scale, allocated before in ascending order
+
+    for (int pass = 0; pass < NUMBER_OF_FEATURE_PASSES; ++pass)
+    {
+        WorkUnitsInvoker units;
+        for (size_t i = 0; i < exact.size(); ++i)
+            addFeaturePass(*this, pass, __scaleWorkspaces[i], units);
+
+        cv::parallel_for_(cv::Range(0, units.size()), units, __parallelStripes());
+    }
+    // bands of rows of all exact scales in every pass, the largest
+    // scale is not left to one thread
+
+    WorkUnitsInvoker resampling, smoothing;
+
+    for (int i = 0; i < nScales; ++i)
+    {
+        DetectionWorkspace &workspace = *detection[i];
+
+        if (scales[i] == exact[reference[i]])
+        {
+            addSmoothing(*this, workspace.features, workspace, resampling);
+            continue;
+        }
+
+        const DetectionWorkspace &octave = __scaleWorkspaces[reference[i]];
+        cv::Size size = scales[i]*lab.size();
+
+        workspace.features.create(__paddedSize(size) / float(shrink), octave.features.type());
+        // bands of it are written by __resampleFeatures
+
+        resampling.add(new FeatureResamplingInvoker(*this, octave.features,
+            octave.lab.size(), size, workspace.features), workspace.features.rows,
+            unitRows(workspace.features.rows,
+            workspace.features.cols*workspace.features.channels()));
+    }
+    // approximated from the nearest octave while exact scales are smoothed
+
+    cv::parallel_for_(cv::Range(0, resampling.size()), resampling, __parallelStripes());
+
+    for (int i = 0; i < nScales; ++i)
+        if (scales[i] != exact[reference[i]])
+            addSmoothing(*this, detection[i]->features, *detection[i], smoothing);
+
+    cv::parallel_for_(cv::Range(0, smoothing.size()), smoothing, __parallelStripes());
+
+    for (int i = 0; i < nScales; ++i)
+        __prepareForestTables(detection[i]->features, detection[i]->indexes, *detection[i]);
+
+    for (int i = 0; i < nScales; ++i)
+        prepareDetection(*this, *detection[i], false);
+
+    for (int phase = 0; phase < detectionPhases(false); ++phase)
+    {
+        WorkUnitsInvoker units;
+        for (int i = 0; i < nScales; ++i)
+            addDetectionPhase(*this, phase, false, *detection[i], units);
+
+        cv::parallel_for_(cv::Range(0, units.size()), units, __parallelStripes());
+    }
+    // units of all scales with similar amounts of work
+
+    for (int i = 0; i < nScales; ++i)
+    {
+        DetectionWorkspace &workspace = *detection[i];
+        cv::Size size = scales[i]*lab.size();
+
+        cv::Mat edges = workspace.edges(cv::Rect(pad, pad, size.width, size.height));
+        __imresize(edges, src.size(), workspace.resized);
+    }
+    // cv::resize is parallel itself
+
+    _dst.create(src.size(), cv::DataType<float>::type);
+    cv::Mat dst = _dst.getMat();
+
+    ScaleAverageInvoker average(detection, dst);
+    cv::parallel_for_(cv::Range(0, dst.rows), average, __parallelStripes());
+}
+
+DetectionParameters::DetectionParameters()
+{
+    CV_INIT_VECTOR(float, defaultScales, {0.5f, 1.0f, 2.0f});
+    scales = defaultScales;
+
+    fastPyramid = false;
+
+    stride = 0;
+    numberOfTreesToEvaluate = 0;
+
+    coarseToFine = false;
+    coarseEdgeThreshold = 0.01f;
+    coarseGradientThreshold = 0.3f;
+}
+
+void StructuredEdgeDetection::setDetectionParameters(const DetectionParameters &parameters)
+{
+    const std::vector <float> &scales = parameters.scales;
+
+    CV_Assert( !scales.empty() );
+    for (size_t i = 0; i < scales.size(); ++i)
+    {
+        CV_Assert( scales[i] > 0 );
+        CV_Assert( std::count(scales.begin(), scales.end(), scales[i]) == 1 );
+    }
+    // every scale has its own workspace
+
+    if (parameters.stride != 0)
+        CV_Assert( parameters.stride > 0 && parameters.stride % __rf.options.shrinkNumber == 0
+            && parameters.stride <= __rf.options.patchInnerSize );
+    // patches on the grid of features, inner patches still cover the image
+
+    CV_Assert( parameters.numberOfTreesToEvaluate >= 0
+        && parameters.numberOfTreesToEvaluate <= __rf.options.numberOfTrees );
+
+    if (parameters.coarseToFine)
+    {
+        int stride = parameters.stride > 0 ? parameters.stride : __rf.options.stride;
+
+        CV_Assert( 2*stride <= __rf.options.patchInnerSize );
+        CV_Assert( parameters.coarseEdgeThreshold >= 0 && parameters.coarseGradientThreshold >= 0 );
+    }
+    // inner patches of the coarse grid still cover the image
+
+    __parameters = parameters;
+}
+
+int StructuredEdgeDetection::__stride() const
+{
+    return __parameters.stride > 0 ? __parameters.stride : __rf.options.stride;
+}
+
+int StructuredEdgeDetection::__numberOfTreesToEvaluate() const
+{
+    return __parameters.numberOfTreesToEvaluate > 0
+        ? __parameters.numberOfTreesToEvaluate : __rf.options.numberOfTreesToEvaluate;
+}
+
+void StructuredEdgeDetection::setNumberOfThreads(const int numberOfThreads)
+{
+    CV_Assert( numberOfThreads >= 0 );
+    __numberOfThreads = numberOfThreads;
+}
+
+ThreadLimit::ThreadLimit(const int numberOfThreads)
+{
+    __active = numberOfThreads > 0;
+    __previous = cv::getNumThreads();
+
+    if (__active)
+        cv::setNumThreads(numberOfThreads);
+}
+
+ThreadLimit::~ThreadLimit()
+{
+    if (__active)
+        cv::setNumThreads(__previous);
+}
+
+double StructuredEdgeDetection::__parallelStripes() const
+{
+    return __numberOfThreads > 0 ? double(__numberOfThreads) : -1.0;
+}
+
+void StructuredEdgeDetection::setForestEvaluation(const int type)
+{
+    CV_Assert( type == FOREST_EVALUATION_SCALAR || type == FOREST_EVALUATION_SIMD
+        || type == FOREST_EVALUATION_QUICKSCORER );
+    __forestEvaluation = type;
+}
+
+StructuredEdgeDetection::StructuredEdgeDetection(const std::string &filename)
+{
+    __forestEvaluation = FOREST_EVALUATION_SCALAR;
+    __numberOfThreads = 0;
+
+    loadForest(filename, __rf);
+    packForest(__rf, __nodes);
+    reorderPackedForest(__rf, __nodes);
+}
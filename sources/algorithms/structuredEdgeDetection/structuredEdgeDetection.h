@@ -6,11 +6,17 @@
 #ifndef structuredEdgeDetection_H
 #define structuredEdgeDetection_H
 
+#include <map>
+
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/ml/ml.hpp>
 
+#include "randomForest.h"
+#include "forestEvaluation.h"
+#include "featureKernels.h"
+
 #ifndef CV_SQR
 #  define CV_SQR(x)  ((x)*(x))
 #endif
@@ -24,89 +30,286 @@
 
 typedef cv::Mat NChannelsMat;
 
-struct RandomForestOptions
+struct GradientWorkspace
 {
-    //----------------------------------------------------------
-    // model params
-
-    int numberOfOutputChannels; // number of edge orientation bins for output
-
-    int patchSize;      // width of image patches
-    int patchInnerSize; // width of patch predicted part
-    //----------------------------------------------------------
-
-    // feature params
-
-    int regFeatureSmoothingRadius;    // radius for smoothing of regular features
-    // (using convolution with triangle filter
-
-    int ssFeatureSmoothingRadius;     // radius for smoothing of additional features
-    // (using convolution with triangle filter)
-
-    int shrinkNumber;                 // amount to shrink channels
-
-    int numberOfGradientOrientations; // number of orientations per gradient scale
+    cv::Mat image;         // Lab image at the scale of gradients
+    cv::Mat magnitude;     // normalized gradient magnitude
+    cv::Mat bins;          // orientation bins of magnitude
+    cv::Mat normalization; // smoothed magnitude
+    std::vector <cv::Mat> histograms;
+};
+// buffers of feature passes at one scale, magnitude and bins can be
+// parts of maps of another pyramid level, image is empty then
 
-    int gradientSmoothingRadius;      // radius for smoothing of gradients
-    // (using convolution with triangle filter)
+enum FeaturePass
+{
+    FEATURE_PASS_GRADIENTS = 0, // magnitude and orientation bins
+    FEATURE_PASS_NORMALIZATION, // smoothed magnitude
+    FEATURE_PASS_DIVISION,      // magnitude normalized by it
+    FEATURE_PASS_HISTOGRAMS,    // orientation histograms
+    FEATURE_PASS_MIXING,        // planes shrunk to features and interleaved
+    NUMBER_OF_FEATURE_PASSES
+};
+// steps of feature extraction, every one needs all rows of the previous ones
 
-    int gradientNormalizationRadius;  // gradient normalization radius
-    int selfsimilarityGridSize;       // number of self similarity cells
+struct DetectionParameters
+{
+    std::vector <float> scales; // distinct scales of detectMultipleScales, {0.5, 1, 2} by default
+    bool fastPyramid;           // features computed only at octaves nearest to scales,
+                                // resampled to the others (false by default)
 
-    //----------------------------------------------------------
-    // detection params
+    int stride;                  // step between patches in pixels, multiple of shrinkNumber
+                                 // up to patchInnerSize, 0 (default) for the one of the model
+    int numberOfTreesToEvaluate; // trees per patch, 0 (default) for the one of the model
 
-    int numberOfTrees;            // number of trees in forest to train
-    int numberOfTreesToEvaluate;  // number of trees to evaluate per location
+    bool coarseToFine;             // forest evaluated at every second patch first, then at all
+                                   // patches only around coarse ones over thresholds (false by default)
+    float coarseEdgeThreshold;     // mean fraction of inner patch pixels on edges in leaves, 0.01 by default
+    float coarseGradientThreshold; // normalized gradient magnitude under inner patches, 0.3 by default
 
-    int stride;                   // stride at which to compute edges
+    DetectionParameters();
 };
+// runtime trade-offs of accuracy for speed, e.g. stride 4 and scales {1}
+// for thumbnails, the model stays the same
 
-struct RandomForest
+struct DetectionWorkspace
 {
-    RandomForestOptions options;
+    cv::Mat lab;    // source converted to Lab
+    cv::Mat padded; // reflection padded source
+    cv::Mat shrunk; // Lab at the resolution of features
+
+    std::vector <GradientWorkspace> gradients; // one per scale of gradients
+    std::vector <cv::Mat> planes; // feature channels before mixing
+    std::vector <int> fromTo;
+
+    int numberOfBands; // most bands a loop of rows of this workspace is split into
+    std::vector <std::vector <float> > bandBuffers;  // scratch of every band of feature
+                                                     // passes, then of smoothing
+    std::vector <std::vector <cv::Mat> > bandPlanes; // rows of planes mixed by every band
+
+    NChannelsMat features;
+    NChannelsMat regFeatures, ssFeatures; // smoothed features
+    NChannelsMat indexes;
+    std::vector <int> roots, offsets;
+    std::vector <int> coarseRoots, coarseOffsets; // every second patch of roots and offsets
+    cv::Mat coarseActivity; // coarse patches over thresholds of coarse-to-fine evaluation
+    cv::Mat patchWeights;   // votes of every patch, 0 for patches left out
+
+    cv::Ptr <CompiledForest> compiledForest; // forest prepared for features
+    cv::Ptr <QuickScorerForest> quickScorer;
+    int stride, numberOfTreesToEvaluate;     // and parameters it was prepared with
+
+    std::vector <int> bandBounds, edgeOffsets;
+    std::vector <cv::Mat> accumulators;
+    cv::Mat edges;
+    cv::Mat resized; // edges resampled to the source size
+};
+// intermediate buffers of detection and scratch of its bands, allocated on first
+// use and reused while image geometry and the number of threads stay the same,
+// one per concurrently processed image
 
-    int numberOfTreeNodes;
+class ThreadLimit
+{
+public:
+    int __previous; // cv::getNumThreads before, restored on destruction
+    bool __active;
 
-    std::vector <int> featureIds;     // feature coordinate thresholded at k-th node
-    std::vector <float> thresholds;   // threshold applied to featureIds[k] at k-th node
-    std::vector <int> childs;         // k --> child[k] - 1, child[k]
+    ThreadLimit(const int numberOfThreads);
+    // cv::setNumThreads(numberOfThreads) for the lifetime of the object,
+    // 0 leaves the setting as it is
 
-    std::vector <int> edgeBoundaries; // ...
-    std::vector <int> edgeBins;       // ...
+    ~ThreadLimit();
 };
+// cv::setNumThreads is process-wide, so detections capped this way should not overlap
 
 class StructuredEdgeDetection
 {
 public:
     RandomForest __rf; // random forest trained to detect edges
+    std::vector <PackedNode> __nodes; // __rf trees packed for traversal
+
+    std::map <int, cv::Ptr <CompiledForest> > __compiledForests; // __nodes compiled per feature width
+    std::map <int, cv::Ptr <QuickScorerForest> > __quickScorerForests; // built on demand from __compiledForests
+    cv::Mutex __compiledForestsMutex;
+
+    int __forestEvaluation; // ForestEvaluationType used by __detectEdges
+    int __numberOfThreads;  // cap set by ThreadLimit in detect*, 0 means no cap
+
+    DetectionWorkspace __workspaces[2]; // [0] for single images, both for detectBatch
+    std::vector <DetectionWorkspace> __scaleWorkspaces; // per scale of detectMultipleScales
+
+    DetectionParameters __parameters; // see setDetectionParameters
+
+    int __stride() const;
+    int __numberOfTreesToEvaluate() const;
+    // values used for detection, overridden or the ones of the model
+
+    double __parallelStripes() const;
+    // nstripes argument for cv::parallel_for_, only a granularity hint
+    // of one stripe per thread under the cap, not the cap itself
 
-    cv::Mat __imresize(const cv::Mat &img, const cv::Size &sizeDst);
-    cv::Mat __imsmooth(const cv::Mat &img, const int rad);
-    // image smoothing, authors used triangle convolution
+    void __imresize(const cv::Mat &img, const cv::Size &sizeDst, cv::Mat &dst);
+    // dst shares data with img when sizes are the same
 
-    void __imhog(const cv::Mat &img, cv::Mat &magnitude, cv::Mat &histogram,
-        const int numberOfBins, const int sizeOfPatch,
-        const int gradientNormalizationRadius);
-    // gradient magnitude, histogram of gradient orientations
+    void __rgbToLab(const cv::Mat &img, cv::Mat &labImg);
+    // CV_32FC3 RGB image in [0, 1] to Lab scaled to [0, 1] (see rgbToLab)
 
-    void __getFeatures(const cv::Mat &img, NChannelsMat &features);
+    void __transposedPlanesToLab(const std::vector <cv::Mat> &planes, const double scale,
+        cv::Mat &labImg);
+    // same for R, G and B planes stored transposed (column-major, as in Matlab),
+    // values are multiplied by scale to get [0, 255], planes can be 8U, 32F or 64F
+
+    void __getFeatures(const cv::Mat &img, NChannelsMat &features, DetectionWorkspace &workspace);
     // extracting features for __rf from img
 
-    void __detectEdges(const NChannelsMat &features, cv::Mat &dst);
-    // edge detection
+    void __getLabFeatures(const cv::Mat &labImg, NChannelsMat &features,
+        DetectionWorkspace &workspace);
+    // extracting features for __rf from img already converted by __rgbToLab,
+    // features share workspace.features
+
+    void __prepareFeatures(const cv::Mat &labImg, const DetectionWorkspace *previous,
+        DetectionWorkspace &workspace);
+    // buffers of every FeaturePass for labImg allocated in workspace, gradients
+    // at half scale are taken from previous workspace of labImg/2 if given
+
+    int __featurePassRows(const int pass, const int scale, const DetectionWorkspace &workspace);
+    // rows of pass for gradients of scale (index of workspace.gradients), 0 if none
+
+    void __featurePass(const int pass, const int scale, DetectionWorkspace &workspace,
+        const cv::Range &rows, const int unit);
+    // rows of pass after __prepareFeatures, bands of rows can run in parallel,
+    // each with scratch of its own unit of workspace, workspace.features after the last one
+
+    void __getPaddedLabFeatures(const cv::Mat &labImg, NChannelsMat &features,
+        DetectionWorkspace &workspace);
+    // features of image already converted to Lab padded as detectSingleScale does it
+
+    void __pad(const cv::Mat &img, cv::Mat &imPad);
+    // reflection padding of detectSingleScale
+
+    void __resampleFeatures(const NChannelsMat &features, const cv::Size &size,
+        const cv::Size &sizeDst, NChannelsMat &dst, const cv::Range &rows = cv::Range::all());
+    // padded features of image of size approximated for the image resized
+    // to sizeDst, power law corrected (see fast feature pyramids by Dollar et al.),
+    // given rows only those rows of dst allocated beforehand
+
+    void __detectLab(const cv::Mat &labImg, cv::OutputArray dst,
+        DetectionWorkspace &workspace, const bool transposed = false);
+    // detectSingleScale after color conversion
+
+    cv::Ptr <CompiledForest> __compileForest(const int featureCols, const int channels);
+    // __nodes with feature offsets for features of featureCols width, cached
+
+    cv::Ptr <QuickScorerForest> __compileQuickScorer(const int featureCols, const int channels);
+    // bitvector representation of compiled forest, cached as well
+
+    void __evaluateForest(const NChannelsMat &features, NChannelsMat &indexes,
+        DetectionWorkspace &workspace);
+    // leaf indices of nTreesEval trees for every patch
+
+    void __prepareForest(const NChannelsMat &features, NChannelsMat &indexes,
+        DetectionWorkspace &workspace);
+    // __evaluateForest without the evaluation, smoothed features,
+    // compiled forest and tables are left in workspace
+
+    void __prepareForestTables(const NChannelsMat &features, NChannelsMat &indexes,
+        DetectionWorkspace &workspace);
+    // same after features are smoothed
+
+    void __prepareSmoothing(const NChannelsMat &features, DetectionWorkspace &workspace);
+    // workspace.regFeatures and ssFeatures allocated for features,
+    // sharing data with them when there is nothing to smooth
+
+    void __smoothFeatures(const NChannelsMat &features, DetectionWorkspace &workspace,
+        const cv::Range &rows, const int unit);
+    // rows of smoothed features after __prepareSmoothing, authors used triangle
+    // convolution, bands of rows can run in parallel with scratch of their units
+
+    void __evaluateCoarseToFine(const NChannelsMat &features, NChannelsMat &indexes,
+        DetectionWorkspace &workspace);
+    // __evaluateForest at every second patch of rows and columns, then at all patches
+    // near coarse ones over thresholds of __parameters, workspace.patchWeights
+    // let a coarse patch vote for the patches around it left out
+
+    void __prepareCoarseToFine(const NChannelsMat &indexes, DetectionWorkspace &workspace);
+    // tables and buffers of __evaluateCoarseToFine after __prepareForest
+
+    void __detectEdges(const NChannelsMat &features, cv::Mat &dst,
+        DetectionWorkspace &workspace);
+    // edge map of features.size()*shrink, votes of leaf edge bins normalized
+
+    cv::Size __paddedSize(const cv::Size &size);
+    // size of reflection padded image detectSingleScale works on
+
+    int __tileHalo();
+    // margin in pixels tiles need to reproduce whole image features and edges
+
+    void __detectTile(const cv::Mat &src, const cv::Rect &roi, cv::Mat &dst,
+        DetectionWorkspace &workspace);
+    // edges of src inside roi written to dst(roi), computed from roi plus halo only
 
     //----------------------------------------------------------
 
     void detectSingleScale(cv::InputArray src, cv::OutputArray dst);
-    // detect edges in src, dst  is vector of matrices
-    // with edges probabilities for each edge orientation
+    // detect edges in src, dst is single-channel float map
+    // of edge probabilities with the size of src, buffers
+    // of the detector are reused, so calls should not overlap
+
+    void detectSingleScale(cv::InputArray src, cv::OutputArray dst,
+        DetectionWorkspace &workspace);
+    // same with buffers of the caller, one workspace per thread
+    // lets threads share the detector
+
+    void detectSingleScaleTransposed(const std::vector <cv::Mat> &planes,
+        const double scale, cv::OutputArray dst);
+    // detectSingleScale for image given by transposed planes (see __transposedPlanesToLab),
+    // e.g. wrapping Matlab array without copying, dst is transposed as well,
+    // preallocated dst of the right size and type is written in place
+
+    void detectSingleScaleTransposed(const std::vector <cv::Mat> &planes,
+        const double scale, cv::OutputArray dst, DetectionWorkspace &workspace);
+    // same with buffers of the caller
+
+    void getFeaturesTransposed(const std::vector <cv::Mat> &planes, const double scale,
+        NChannelsMat &features);
+    // features of the unpadded image given by transposed planes (see __transposedPlanesToLab),
+    // features share buffers of the detector until its next call
+
+    void getFeaturesTransposed(const std::vector <cv::Mat> &planes, const double scale,
+        NChannelsMat &features, DetectionWorkspace &workspace);
+    // same with buffers of the caller
+
+    void detectBatch(const std::vector <cv::Mat> &src, std::vector <cv::Mat> &dst);
+    // detectSingleScale for every image of src, row bands of features of the next
+    // image are extracted in the same parallel loops as edges of the previous one
+
+    void detectSingleScaleTiled(cv::InputArray src, cv::OutputArray dst, const int tileSize = 512);
+    // same as detectSingleScale (up to rounding in box filters),
+    // but features and leaf indices exist only for one tile plus halo at a time
 
     void detectMultipleScales(cv::InputArray src, cv::OutputArray dst);
-    // detect edges in {0.5, 1, and 2}-times scaled source image, then average
+    // detect edges in source image scaled by every scale of parameters, then average,
+    // Lab conversion is done once and gradients are shared between octaves,
+    // work of all scales is split into similar units run in parallel
+
+    virtual void setDetectionParameters(const DetectionParameters &parameters);
+    // scales, stride and number of trees used by all detect* methods,
+    // with fastPyramid more scales cost little more than three,
+    // coarseToFine applies to all but detectMultipleScales
+
+    const DetectionParameters &detectionParameters() const { return __parameters; };
+
+    void setNumberOfThreads(const int numberOfThreads);
+    // upper limit on threads of every detect* call, set by cv::setNumThreads
+    // and restored when the call returns, 1 means single-threaded,
+    // 0 (default) leaves it to the caller (see ThreadLimit)
+
+    void setForestEvaluation(const int type);
+    // one of ForestEvaluationType (forestEvaluation.h), all give identical results
 
     StructuredEdgeDetection(const std::string &filename);
-    // load options and forest from filename
+    // load options and forest from filename,
+    // binary model (see randomForest.h) is mapped, YAML one is parsed
 
     virtual ~StructuredEdgeDetection() {};
 };
@@ -0,0 +1,120 @@
+#include "videoEdgeDetection.h"
+
+cv::Mat VideoEdgeDetection::__shrinkFrame(const cv::Mat &src)
+{
+    int shrink = __rf.options.shrinkNumber;
+
+    cv::Mat shrunk;
+    cv::resize(src, shrunk, cv::Size( (src.cols + shrink - 1)/shrink,
+        (src.rows + shrink - 1)/shrink ), 0.0, 0.0, cv::INTER_AREA);
+
+    return shrunk;
+}
+
+void VideoEdgeDetection::detectFrame
+    (cv::InputArray _src, cv::OutputArray _dst)
+{
+    cv::Mat src = _src.getMat();
+    CV_Assert( src.type() == CV_32FC3 );
+
+    ThreadLimit threadLimit(__numberOfThreads);
+
+    int shrink = __rf.options.shrinkNumber;
+
+    cv::Mat current = __shrinkFrame(src);
+
+    if (__edges.size() != src.size() || __reference.size() != current.size())
+    {
+        detectSingleScale(src, __edges);
+        __reference = current;
+        __recomputedFraction = 1.0;
+
+        __edges.copyTo(_dst);
+        return;
+    }
+
+    cv::Mat difference;
+    cv::absdiff(current, __reference, difference);
+    cv::reduce(difference.reshape(1, current.rows*current.cols),
+        difference, 1, CV_REDUCE_MAX, -1);
+
+    cv::Mat changed = difference.reshape(1, current.rows) > __changeThreshold;
+    // compared to the frame edges were computed from, so slow drift is caught as well
+
+    int halo = __tileHalo();
+    cv::Rect frame(0, 0, changed.cols, changed.rows);
+
+    std::vector <cv::Rect> dirtyTiles;
+    int dirtyArea = 0;
+
+    for (int y = 0; y < src.rows; y += __tileSize)
+        for (int x = 0; x < src.cols; x += __tileSize)
+        {
+            cv::Rect tile(x, y, std::min(__tileSize, src.cols - x),
+                std::min(__tileSize, src.rows - y));
+
+            int x0 = (tile.x - halo) / shrink - 1;
+            int y0 = (tile.y - halo) / shrink - 1;
+            int x1 = (tile.br().x + halo) / shrink + 2;
+            int y1 = (tile.br().y + halo) / shrink + 2;
+            // pixels of the shrunk frame edges of the tile depend on
+
+            cv::Rect support = cv::Rect(x0, y0, x1 - x0, y1 - y0) & frame;
+            if (cv::countNonZero(changed(support)) == 0)
+                continue;
+
+            dirtyTiles.push_back(tile);
+            dirtyArea += tile.area();
+        }
+
+    __recomputedFraction = double(dirtyArea) / src.size().area();
+
+    if (2*dirtyArea > src.size().area())
+    {// halos make partial recomputation of most of the frame more expensive
+        detectSingleScale(src, __edges);
+        __reference = current;
+    }
+    else
+    {
+        for (size_t k = 0; k < dirtyTiles.size(); ++k)
+            __detectTile(src, dirtyTiles[k], __edges, __workspaces[0]);
+
+        current.copyTo(__reference, changed);
+        // every tile depending on a changed pixel has been recomputed
+    }
+
+    __edges.copyTo(_dst);
+}
+
+void VideoEdgeDetection::reset()
+{
+    __reference.release();
+    __edges.release();
+}
+
+void VideoEdgeDetection::setChangeThreshold(const float threshold)
+{
+    CV_Assert( threshold >= 0 );
+    __changeThreshold = threshold;
+}
+
+void VideoEdgeDetection::setDetectionParameters(const DetectionParameters &parameters)
+{
+    StructuredEdgeDetection::setDetectionParameters(parameters);
+    reset();
+}
+
+void VideoEdgeDetection::setTileSize(const int tileSize)
+{
+    CV_Assert( tileSize > 0 );
+    __tileSize = tileSize;
+    reset();
+}
+
+VideoEdgeDetection::VideoEdgeDetection(const std::string &filename)
+    : StructuredEdgeDetection(filename)
+{
+    __changeThreshold = 2/255.0f;
+    __tileSize = 128;
+    __recomputedFraction = 1.0;
+}
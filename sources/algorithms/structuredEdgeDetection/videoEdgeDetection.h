@@ -0,0 +1,54 @@
+/**
+*  \file videoEdgeDetection.h
+*  \brief structured edge detection for static camera streams, only changed regions are recomputed
+*/
+
+#ifndef videoEdgeDetection_H
+#define videoEdgeDetection_H
+
+#include "structuredEdgeDetection.h"
+
+class VideoEdgeDetection : public StructuredEdgeDetection
+{
+public:
+    cv::Mat __reference; // shrunk frame the current __edges were computed from
+    cv::Mat __edges;     // edges of the last frame
+
+    float __changeThreshold; // change of a shrunk pixel that makes its tiles dirty
+    int __tileSize;          // side of recomputed tiles in pixels
+
+    double __recomputedFraction; // part of the last frame area recomputed
+
+    cv::Mat __shrinkFrame(const cv::Mat &src);
+    // frame at shrinkNumber resolution used for change detection
+
+    //----------------------------------------------------------
+
+    void detectFrame(cv::InputArray src, cv::OutputArray dst);
+    // same as detectSingleScale, but only tiles with changes
+    // within their halo since they were computed are recomputed
+
+    void reset();
+    // forget the previous frame, next one is computed as a whole
+
+    void setChangeThreshold(const float threshold);
+    // maximal per channel difference of shrunk frames treated as no change
+
+    virtual void setDetectionParameters(const DetectionParameters &parameters);
+    // see StructuredEdgeDetection, resets the detector, edges
+    // of unchanged tiles were computed with the old parameters
+
+    void setTileSize(const int tileSize);
+    // granularity of recomputation, resets the detector, any size gives
+    // tiles matching full frame recomputation (see __detectTile)
+
+    double recomputedFraction() const { return __recomputedFraction; };
+    // part of the last frame that was recomputed, 1 for full frames
+
+    VideoEdgeDetection(const std::string &filename);
+    // see StructuredEdgeDetection
+
+    virtual ~VideoEdgeDetection() {};
+};
+
+#endif
@@ -12,6 +12,8 @@
 #include <mex.h>
 
 #include "thirdparty/MxArray.h"
+#include "modelRegistry.h"
+#include "mexConversion.h"
 
 #include <structuredEdgeDetection.h>
 
@@ -42,17 +44,13 @@ MEXFUNCTION_LINKAGE void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const
     if (nlhs != 1) mexErrMsgTxt("nlhs != 1");
     if (nrhs != 2) mexErrMsgTxt("nrhs != 2");
 
-    cv::Mat src = MxArray(prhs[0]).toMat();
-    src.convertTo(src, cv::DataType<float>::type);
-    cv::cvtColor(src, src, CV_BGR2RGB);
-
-    std::string modelFile = MxArray(prhs[1]).toString();
-    StructuredEdgeDetection img2edges(modelFile);
-
-    cv::Mat edges;
-    img2edges.__getFeatures(src, edges);
-
-    edges.convertTo(edges, cv::DataType<double>::type);
-
-    plhs[0] = MxArray(edges);
-}   
\ No newline at end of file
+    try
+    {
+        std::string modelFile = MxArray(prhs[1]).toString();
+        plhs[0] = extractFeatures(getDetector(modelFile), prhs[0]);
+    }
+    catch (const cv::Exception &e)
+    {
+        mexErrMsgTxt(e.what());
+    }
+}
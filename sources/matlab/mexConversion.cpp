@@ -0,0 +1,103 @@
+#include "mexConversion.h"
+
+double wrapImagePlanes(const mxArray *arr, std::vector <cv::Mat> &planes)
+{
+    const mwSize *dims = mxGetDimensions(arr);
+
+    if (mxGetNumberOfDimensions(arr) != 3 || dims[2] != 3 || mxIsComplex(arr))
+        mexErrMsgTxt("image should be real H x W x 3 array");
+
+    int type;
+    double scale;
+
+    switch (mxGetClassID(arr))
+    {
+    case mxUINT8_CLASS:
+        type = CV_8UC1;
+        scale = 1.0;
+        break;
+    case mxSINGLE_CLASS:
+        type = CV_32FC1;
+        scale = 255.0;
+        break;
+    case mxDOUBLE_CLASS:
+        type = CV_64FC1;
+        scale = 255.0;
+        break;
+    default:
+        mexErrMsgTxt("image should be uint8, single or double");
+        return 0;
+    }
+
+    const int rows = int(dims[0]), cols = int(dims[1]);
+    uchar *data = static_cast<uchar *>(mxGetData(arr));
+    size_t planeSize = size_t(rows) * cols * mxGetElementSize(arr);
+
+    planes.resize(3);
+    for (int c = 0; c < 3; ++c)
+        planes[c] = cv::Mat(cols, rows, type, data + (2 - c)*planeSize);
+    // column-major plane is row-major transposed one,
+    // planes are swapped as cvtColor(CV_BGR2RGB) of MxArray::toMat used to do
+
+    return scale;
+}
+
+mxArray *createImagePlanes(const int rows, const int cols, const int channels,
+    std::vector <cv::Mat> &planes)
+{
+    mwSize dims[3] = {mwSize(rows), mwSize(cols), mwSize(channels)};
+
+    mxArray *arr = mxCreateNumericArray(channels > 1 ? 3 : 2, dims, mxSINGLE_CLASS, mxREAL);
+    if (arr == NULL)
+        mexErrMsgTxt("can't allocate output array");
+
+    float *data = static_cast<float *>(mxGetData(arr));
+
+    planes.resize(channels);
+    for (int c = 0; c < channels; ++c)
+        planes[c] = cv::Mat(cols, rows, CV_32FC1, data + size_t(c)*rows*cols);
+
+    return arr;
+}
+
+void deinterleaveTransposed(const cv::Mat &src, std::vector <cv::Mat> &planes)
+{
+    const int channels = src.channels();
+
+    CV_Assert( src.depth() == CV_32F && int(planes.size()) == channels );
+    for (int c = 0; c < channels; ++c)
+        CV_Assert( planes[c].type() == CV_32FC1
+            && planes[c].rows == src.cols && planes[c].cols == src.rows );
+
+    const int blockSize = 64;
+    // columns of src read while writing rows of planes
+
+    for (int x0 = 0; x0 < src.cols; x0 += blockSize)
+    {
+        const int x1 = std::min(x0 + blockSize, src.cols);
+
+        for (int y = 0; y < src.rows; ++y)
+        {
+            const float *srcPtr = src.ptr<float>(y);
+
+            for (int x = x0; x < x1; ++x)
+                for (int c = 0; c < channels; ++c)
+                    planes[c].ptr<float>(x)[y] = srcPtr[x*channels + c];
+        }
+    }
+}
+
+mxArray *extractFeatures(StructuredEdgeDetection &detector, const mxArray *image)
+{
+    std::vector <cv::Mat> planes;
+    double scale = wrapImagePlanes(image, planes);
+
+    NChannelsMat features;
+    detector.getFeaturesTransposed(planes, scale, features);
+
+    std::vector <cv::Mat> channels;
+    mxArray *arr = createImagePlanes(features.rows, features.cols, features.channels(), channels);
+    deinterleaveTransposed(features, channels);
+
+    return arr;
+}
@@ -0,0 +1,33 @@
+/**
+*  \file mexConversion.h
+*  \brief passing images between Matlab arrays and the detector without intermediate copies
+*/
+
+#ifndef mexConversion_H
+#define mexConversion_H
+
+#include <vector>
+
+#include <cv.h>
+#include <mex.h>
+
+#include <structuredEdgeDetection.h>
+
+double wrapImagePlanes(const mxArray *arr, std::vector <cv::Mat> &planes);
+// H x W x 3 uint8, single or double Matlab image as three transposed
+// planes pointing into arr, in the order detector expects them,
+// returns scale bringing values to [0, 255]
+
+mxArray *createImagePlanes(const int rows, const int cols, const int channels,
+    std::vector <cv::Mat> &planes);
+// rows x cols (x channels) single Matlab array,
+// planes are transposed CV_32FC1 headers of its channels
+
+void deinterleaveTransposed(const cv::Mat &src, std::vector <cv::Mat> &planes);
+// planes[c] = transposed channel c of CV_32F src, in one pass
+
+mxArray *extractFeatures(StructuredEdgeDetection &detector, const mxArray *image);
+// single array of features of image (see wrapImagePlanes) detector
+// works on, with one page per channel
+
+#endif
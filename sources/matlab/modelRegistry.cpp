@@ -0,0 +1,77 @@
+#include "modelRegistry.h"
+
+#include <map>
+#include <ctime>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <mex.h>
+
+struct LoadedModel
+{
+    time_t modificationTime; // of the model file when it was loaded
+    cv::Ptr <StructuredEdgeDetection> detector;
+};
+
+static std::map <std::string, LoadedModel> loadedModels; // by model file
+static std::map <int, cv::Ptr <StructuredEdgeDetection> > handles;
+static int nextHandle = 1;
+
+static void clearRegistry()
+{
+    handles.clear();
+    loadedModels.clear();
+}
+
+static cv::Ptr <StructuredEdgeDetection> loadDetector(const std::string &modelFile)
+{
+    static bool atExitRegistered = false;
+    if (!atExitRegistered)
+    {
+        mexAtExit(clearRegistry);
+        atExitRegistered = true;
+    }
+
+    struct stat fileStat;
+    if (stat(modelFile.c_str(), &fileStat) != 0)
+        mexErrMsgTxt(("can't open model file " + modelFile).c_str());
+
+    std::map <std::string, LoadedModel>::iterator it = loadedModels.find(modelFile);
+    if (it != loadedModels.end() && it->second.modificationTime == fileStat.st_mtime)
+        return it->second.detector;
+
+    LoadedModel model;
+    model.modificationTime = fileStat.st_mtime;
+    model.detector = new StructuredEdgeDetection(modelFile);
+    // handles to the stale model keep it alive
+
+    loadedModels[modelFile] = model;
+    return model.detector;
+}
+
+StructuredEdgeDetection &getDetector(const std::string &modelFile)
+{
+    return *loadDetector(modelFile);
+}
+
+int createDetectorHandle(const std::string &modelFile)
+{
+    handles[nextHandle] = loadDetector(modelFile);
+    return nextHandle++;
+}
+
+StructuredEdgeDetection &getDetector(const int handle)
+{
+    std::map <int, cv::Ptr <StructuredEdgeDetection> >::iterator it = handles.find(handle);
+    if (it == handles.end())
+        mexErrMsgTxt("invalid detector handle");
+
+    return *it->second;
+}
+
+void destroyDetectorHandle(const int handle)
+{
+    if (handles.erase(handle) == 0)
+        mexErrMsgTxt("invalid detector handle");
+}
@@ -0,0 +1,26 @@
+/**
+*  \file modelRegistry.h
+*  \brief detectors kept loaded between MEX calls
+*/
+
+#ifndef modelRegistry_H
+#define modelRegistry_H
+
+#include <string>
+
+#include <structuredEdgeDetection.h>
+
+StructuredEdgeDetection &getDetector(const std::string &modelFile);
+// detector for modelFile loaded by an earlier call of this MEX file,
+// reloaded if the file was modified since, all freed by "clear mex"
+
+int createDetectorHandle(const std::string &modelFile);
+// handle to a detector for modelFile, shares the model with getDetector
+
+StructuredEdgeDetection &getDetector(const int handle);
+// detector of handle, MATLAB error for unknown handles
+
+void destroyDetectorHandle(const int handle);
+// release handle, MATLAB error for unknown handles
+
+#endif
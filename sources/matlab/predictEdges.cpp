@@ -12,6 +12,8 @@
 #include <mex.h>
 
 #include "thirdparty/MxArray.h"
+#include "modelRegistry.h"
+#include "mexConversion.h"
 
 #include <structuredEdgeDetection.h>
 
@@ -42,17 +44,22 @@ MEXFUNCTION_LINKAGE void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const
     if (nlhs != 1) mexErrMsgTxt("nlhs != 1");
     if (nrhs != 2) mexErrMsgTxt("nrhs != 2");
 
-    cv::Mat src = MxArray(prhs[0]).toMat();
-    src.convertTo(src, cv::DataType<float>::type);
-    cv::cvtColor(src, src, CV_BGR2RGB);
+    try
+    {
+        std::vector <cv::Mat> planes;
+        double scale = wrapImagePlanes(prhs[0], planes);
 
-    std::string modelFile = MxArray(prhs[1]).toString();
-    StructuredEdgeDetection img2edges(modelFile);
+        std::string modelFile = MxArray(prhs[1]).toString();
+        StructuredEdgeDetection &img2edges = getDetector(modelFile);
 
-    cv::Mat edges;
-    img2edges.detectSingleScale(src, edges);
+        std::vector <cv::Mat> edges;
+        plhs[0] = createImagePlanes(planes[0].cols, planes[0].rows, 1, edges);
 
-    edges.convertTo(edges, cv::DataType<double>::type);
-
-    plhs[0] = MxArray(edges);
-}   
\ No newline at end of file
+        img2edges.detectSingleScaleTransposed(planes, scale, edges[0]);
+        // written directly into plhs[0]
+    }
+    catch (const cv::Exception &e)
+    {
+        mexErrMsgTxt(e.what());
+    }
+}
@@ -0,0 +1,66 @@
+#include <string>
+
+#include <cv.h>
+
+#include <mat.h>
+#include <mex.h>
+
+#include "thirdparty/MxArray.h"
+#include "modelRegistry.h"
+#include "mexConversion.h"
+
+// handle interface to a detector kept loaded between calls:
+//
+//   h = structuredEdges('create', modelFile);
+//   E = structuredEdges('predict', h, I);
+//   F = structuredEdges('features', h, I);
+//   structuredEdges('destroy', h);
+
+MEXFUNCTION_LINKAGE void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    if (nrhs < 2) mexErrMsgTxt("nrhs < 2");
+
+    std::string command = MxArray(prhs[0]).toString();
+
+    try
+    {
+        if (command == "create")
+        {
+            if (nlhs != 1) mexErrMsgTxt("nlhs != 1");
+            if (nrhs != 2) mexErrMsgTxt("nrhs != 2");
+
+            plhs[0] = MxArray(createDetectorHandle(MxArray(prhs[1]).toString()));
+        }
+        else if (command == "predict" || command == "features")
+        {
+            if (nlhs != 1) mexErrMsgTxt("nlhs != 1");
+            if (nrhs != 3) mexErrMsgTxt("nrhs != 3");
+
+            StructuredEdgeDetection &img2edges = getDetector(MxArray(prhs[1]).toInt());
+
+            if (command == "predict")
+            {
+                std::vector <cv::Mat> planes, result;
+                double scale = wrapImagePlanes(prhs[2], planes);
+
+                plhs[0] = createImagePlanes(planes[0].cols, planes[0].rows, 1, result);
+                img2edges.detectSingleScaleTransposed(planes, scale, result[0]);
+            }
+            else
+                plhs[0] = extractFeatures(img2edges, prhs[2]);
+        }
+        else if (command == "destroy")
+        {
+            if (nlhs != 0) mexErrMsgTxt("nlhs != 0");
+            if (nrhs != 2) mexErrMsgTxt("nrhs != 2");
+
+            destroyDetectorHandle(MxArray(prhs[1]).toInt());
+        }
+        else
+            mexErrMsgTxt(("unknown command " + command).c_str());
+    }
+    catch (const cv::Exception &e)
+    {
+        mexErrMsgTxt(e.what());
+    }
+}